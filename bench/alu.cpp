@@ -0,0 +1,103 @@
+#include <libgbc/alu.hpp>
+#include <libgbc/machine.hpp>
+#include <stuff.hpp>
+
+using namespace gbc;
+
+// Compares the ALU lookup tables against the functions they are generated
+// from, over the operands of the instructions a ROM executes.
+struct trace_t
+{
+    std::vector<uint32_t> alu;    // sub << 16 | A << 8 | operand
+    std::vector<uint32_t> daa;    // flags << 8 | A
+    std::vector<uint32_t> rotate; // op << 9 | carry << 8 | value
+};
+
+// the ADD/SUB/CP, DAA and rotate instructions at each step of a headless run
+static trace_t record(const char* romfile, const uint64_t frames)
+{
+    const auto rom = Rom::open(romfile);
+    Machine machine(rom);
+    machine.gpu.scanline_rendering(false);
+    auto& regs = machine.cpu.registers();
+    auto& mem = machine.memory;
+    auto operand = [&](uint8_t index) {
+        return ((index & 0x7) == 6) ? mem.read8(regs.hl) : regs.getdest(index);
+    };
+    trace_t trace;
+    while (machine.gpu.frame_count() < frames && machine.is_running())
+    {
+        const uint8_t opcode = mem.read8(regs.pc);
+        regs.resolve_flags();
+        const bool carry = regs.flags & MASK_CARRY;
+        if (opcode >= 0x80 && opcode < 0xC0)
+        {
+            const uint8_t op = (opcode >> 3) & 0x7;
+            if (op == ADD || op == SUB || op == CP)
+                trace.alu.push_back(((op != ADD) << 16) | (regs.accum << 8) | operand(opcode));
+        }
+        else if (opcode == 0xC6 || opcode == 0xD6 || opcode == 0xFE)
+        {
+            trace.alu.push_back(((opcode != 0xC6) << 16) | (regs.accum << 8) |
+                                mem.read8(regs.pc + 1));
+        }
+        else if (opcode == 0x27)
+            trace.daa.push_back((regs.flags << 8) | regs.accum);
+        else if ((opcode & 0xE7) == 0x07) // RLCA, RRCA, RLA, RRA
+            trace.rotate.push_back((opcode >> 3) << 9 | (carry << 8) | regs.accum);
+        else if (opcode == 0xCB)
+        {
+            const uint8_t cb = mem.read8(regs.pc + 1);
+            if (cb < 0x40) trace.rotate.push_back((cb >> 3) << 9 | (carry << 8) | operand(cb));
+        }
+        machine.cpu.simulate();
+    }
+    return trace;
+}
+
+template <typename Func>
+static void measure(const char* name, const std::vector<uint32_t>& trace, Func func)
+{
+    if (trace.empty()) return;
+    static const size_t ITERATIONS = 50'000'000;
+    const size_t passes = (ITERATIONS + trace.size() - 1) / trace.size();
+    const uint64_t t0 = micros_now();
+    uint32_t checksum = 0;
+    for (size_t pass = 0; pass < passes; pass++)
+        for (const uint32_t r : trace) { checksum += func(r); }
+    const uint64_t t1 = micros_now();
+    printf("%-16s %.2f ns/op (checksum %08x)\n", name,
+           (t1 - t0) * 1000.0 / (passes * trace.size()), checksum);
+}
+
+int main(int argc, char** args)
+{
+    const char* romfile = "../emulator/tests/cpu_instrs.gb";
+    if (argc >= 2) romfile = args[1];
+    const int frames = (argc >= 3) ? atoi(args[2]) : 2000;
+    const auto trace = record(romfile, frames);
+    printf("%s: %zu ALU, %zu DAA and %zu rotate operands in %d frames\n", romfile,
+           trace.alu.size(), trace.daa.size(), trace.rotate.size(), frames);
+
+    measure("alu flags table", trace.alu, [](uint32_t r) {
+        return ALU_FLAGS[alu_index(r & 0x10000, r >> 8, r)];
+    });
+    measure("alu flags", trace.alu, [](uint32_t r) { return alu_flags(r & 0x10000, r >> 8, r); });
+    measure("daa table", trace.daa, [](uint32_t r) {
+        const auto result = DAA_TABLE[daa_index(r, r >> 8)];
+        return result.value | (result.flags << 8);
+    });
+    measure("daa", trace.daa, [](uint32_t r) {
+        const auto result = daa(r, r >> 8);
+        return result.value | (result.flags << 8);
+    });
+    measure("rotate table", trace.rotate, [](uint32_t r) {
+        const auto result = ROTATE_TABLE[rotate_index(r >> 9, r, r & 0x100)];
+        return result.value | (result.flags << 8);
+    });
+    measure("rotate", trace.rotate, [](uint32_t r) {
+        const auto result = rotate(r >> 9, r, r & 0x100);
+        return result.value | (result.flags << 8);
+    });
+    return 0;
+}
@@ -0,0 +1,35 @@
+#include <libgbc/machine.hpp>
+#include <stuff.hpp>
+
+// Runs a ROM headless for a number of frames and reports emulation speed.
+// Build it with and without GAMEBRO_THREADED_CODE to compare the engines.
+int main(int argc, char** args)
+{
+    const char* romfile = "../emulator/tests/cpu_instrs.gb";
+    if (argc >= 2) romfile = args[1];
+    const int frames = (argc >= 3) ? atoi(args[2]) : 2000;
+    const int rounds = (argc >= 4) ? atoi(args[3]) : 5;
+
+#ifdef GAMEBRO_THREADED_CODE
+    const char* engine = "threaded";
+#else
+    const char* engine = "switch";
+#endif
+    const auto rom = gbc::Rom::open(romfile);
+    uint64_t best = UINT64_MAX;
+    uint64_t cycles = 0;
+    for (int round = 0; round < rounds; round++)
+    {
+        gbc::Machine machine(rom);
+        machine.gpu.scanline_rendering(false);
+
+        const uint64_t t0 = micros_now();
+        for (int i = 0; i < frames && machine.is_running(); i++) { machine.simulate_one_frame(); }
+        const uint64_t t1 = micros_now();
+        best = std::min(best, t1 - t0);
+        cycles = machine.cpu.gettime();
+    }
+    printf("%-8s %s: %d frames, %lu cycles in %.3fs (%.1f fps)\n", engine, romfile, frames,
+           cycles, best / 1e6, frames / (best / 1e6));
+    return 0;
+}
@@ -0,0 +1,16 @@
+#!/bin/bash
+# compare the switch and threaded-code interpreter loops, then the ALU tables
+# on the operands the same ROM executes
+set -e
+ROM=${1:-../emulator/tests/cpu_instrs.gb}
+FRAMES=${2:-2000}
+for engine in switch threaded; do
+	if [ $engine == "threaded" ]; then THREADED=ON; else THREADED=OFF; fi
+	mkdir -p build_$engine
+	pushd build_$engine > /dev/null
+	cmake .. -DGAMEBRO_THREADED_CODE=$THREADED > /dev/null
+	make -j4 bench alu > /dev/null
+	popd > /dev/null
+	./build_$engine/bench $ROM $FRAMES
+done
+./build_switch/alu $ROM $FRAMES
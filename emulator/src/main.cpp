@@ -55,10 +55,10 @@ int main(int argc, char** args)
     const char* romfile = "tests/instr_timing.gb";
     if (argc >= 2) romfile = args[1];
 
-    const auto romdata = load_file(romfile);
-    printf("Loaded %zu bytes ROM\n", romdata.size());
+    const auto rom = gbc::Rom::open(romfile);
+    printf("Loaded %zu bytes ROM: %s\n", rom->size(), rom->title().c_str());
 
-    machine = new gbc::Machine(romdata);
+    machine = new gbc::Machine(rom);
     machine->gpu.scanline_rendering(false);
     machine->break_now();
     /*
@@ -1,24 +1,637 @@
 #include <libgbc/machine.hpp>
+#include <libgbc/pages.hpp>
+#include <libgbc/rom.hpp>
+#include <fstream>
+#include <iterator>
+#include <unistd.h>
 using namespace gbc;
 
 inline void execute_n(gbc::Machine& m, int n)
 {
     while (n--) m.cpu.simulate();
 }
+// the test programs end with HALT, with interrupts disabled
+inline void execute_until_halt(gbc::Machine& m)
+{
+    for (int n = 0; !m.cpu.is_halting(); n++)
+    {
+        assert(n < 1000000);
+        m.cpu.simulate();
+    }
+}
+
+// a 32kB image that jumps to @code at CODE, with a pattern to copy from at 0x1000
+// and HALT after the code, for a cartridge of @type with @ram_size in the header
+static constexpr uint16_t CODE = 0x150;
+static std::vector<uint8_t> make_rom(const std::vector<uint8_t>& code, uint8_t type = 0,
+                                     uint8_t ram_size = 0, bool cgb = false)
+{
+    std::vector<uint8_t> rom(0x8000);
+    rom[0x143] = cgb ? 0x80 : 0x00;
+    rom[0x147] = type;
+    rom[0x149] = ram_size;
+    for (size_t i = 0x1000; i < rom.size(); i++) rom[i] = i * 7 + (i >> 8);
+    const uint8_t entry[] = {0x00, 0xC3, CODE & 0xFF, CODE >> 8}; // NOP; JP CODE
+    std::copy(std::begin(entry), std::end(entry), &rom[0x100]);
+    std::copy(code.begin(), code.end(), &rom[CODE]);
+    rom[CODE + code.size()] = 0x76;
+    // the header checksum, so that the image is valid
+    uint8_t checksum = 0;
+    for (int i = 0x134; i < 0x14D; i++) checksum = checksum - rom[i] - 1;
+    rom[0x14D] = checksum;
+    return rom;
+}
+static void assert_same_state(Machine& a, Machine& b)
+{
+    auto& ra = a.cpu.registers();
+    auto& rb = b.cpu.registers();
+    ra.resolve_flags();
+    rb.resolve_flags();
+    assert(ra.af == rb.af && ra.bc == rb.bc && ra.de == rb.de && ra.hl == rb.hl);
+    assert(ra.sp == rb.sp && ra.pc == rb.pc);
+    assert(a.cpu.gettime() == b.cpu.gettime());
+    for (int addr = 0xC000; addr < 0xE000; addr++)
+        assert(a.memory.read8(addr) == b.memory.read8(addr));
+}
+template <typename Func> static bool throws_machine_exception(Func func)
+{
+    try
+    {
+        func();
+    }
+    catch (const MachineException&)
+    {
+        return true;
+    }
+    return false;
+}
+
+// a breakpoint that is never reached keeps loops from being fused
+static void disable_fusing(Machine& machine)
+{
+    machine.cpu.breakpoint(0x7FFF, breakpoint_t{[](CPU&, uint8_t) {}});
+}
 
 static void test_alu()
 {
-    Machine machine({0x3E, 0xFF, // LD A,  0xFF
-                     0xD6, 0x1,  // SUB A, 0x1
-                     0x0, 0x0},
-                    false);
-    execute_n(machine, 2);
+    // the machine only refers to the image
+    const auto rom = make_rom({0x3E, 0xFF, // LD A,  0xFF
+                               0xD6, 0x1,  // SUB A, 0x1
+                               0x0, 0x0});
+    Machine machine(rom);
+    execute_n(machine, 4);
     assert(machine.cpu.registers().accum == 0xfe);
 }
 
+// a fused loop must leave everything as the interpreter would
+static void test_fused_loop(const std::vector<uint8_t>& setup, const std::vector<uint8_t>& loop)
+{
+    auto code = setup;
+    code.insert(code.end(), loop.begin(), loop.end());
+    const auto rom = make_rom(code);
+    Machine fused(rom);
+    Machine interpreted(rom);
+    disable_fusing(interpreted);
+    execute_until_halt(fused);
+    execute_until_halt(interpreted);
+    assert_same_state(fused, interpreted);
+}
+static void test_fused_loops()
+{
+    // LD HL, 0x1000; LD DE, 0xC000
+    const std::vector<uint8_t> copy = {0x21, 0x00, 0x10, 0x11, 0x00, 0xC0};
+    auto with = [](std::vector<uint8_t> a, const std::vector<uint8_t>& b) {
+        a.insert(a.end(), b.begin(), b.end());
+        return a;
+    };
+    // LD A, (HL+); LD (DE), A; INC DE; DEC B; JR NZ
+    test_fused_loop(with(copy, {0x06, 0xC0}), {0x2A, 0x12, 0x13, 0x05, 0x20, 0xFA});
+    // LD A, (HL-); LD (DE), A; INC DE; DEC C; JR NZ
+    test_fused_loop(with(copy, {0x0E, 0x00}), {0x3A, 0x12, 0x13, 0x0D, 0x20, 0xFA});
+    // LD A, (HL+); LD (DE), A; INC DE; DEC BC; LD A, B; OR C; JR NZ
+    test_fused_loop(with(copy, {0x01, 0x00, 0x18}),
+                    {0x2A, 0x12, 0x13, 0x0B, 0x78, 0xB1, 0x20, 0xF8});
+    // LD HL, 0xC100; LD A, 0x5A, then LD (HL+), A; DEC B; JR NZ
+    test_fused_loop({0x21, 0x00, 0xC1, 0x3E, 0x5A, 0x06, 0x80}, {0x22, 0x05, 0x20, 0xFC});
+    // LD HL, 0xDFFF; LD A, 0xA5, then LD (HL-), A; DEC D; JR NZ
+    test_fused_loop({0x21, 0xFF, 0xDF, 0x3E, 0xA5, 0x16, 0x00}, {0x32, 0x15, 0x20, 0xFC});
+    // DEC B; JR NZ
+    test_fused_loop({0x06, 0x00}, {0x05, 0x20, 0xFD});
+    // DEC BC; LD A, B; OR C; JR NZ
+    test_fused_loop({0x01, 0x00, 0x40}, {0x0B, 0x78, 0xB1, 0x20, 0xFB});
+    // DEC DE; LD A, D; OR E; JR NZ
+    test_fused_loop({0x11, 0x34, 0x12}, {0x1B, 0x7A, 0xB3, 0x20, 0xFB});
+}
+
+// a fused copy into RAM that reaches code which has been run (and cached)
+// after @before bytes, which are interpreted or fused depending on events
+static void test_fused_copy_over_code(const bool jit, const uint8_t before)
+{
+    const uint16_t dst = 0xC100 - before;
+    const std::vector<uint8_t> code = {
+        0x31, 0xFE, 0xDF,       // LD SP, 0xDFFE
+        0x21, 0x00, 0x02,       // LD HL, 0x0200
+        0xCD, 0x00, 0x08,       // CALL copy
+        0xCD, 0x00, 0xC1,       // CALL 0xC100
+        0x47,                   // LD B, A
+        0x21, 0x80, 0x02,       // LD HL, 0x0280
+        0xCD, 0x00, 0x08,       // CALL copy
+        0xCD, 0x00, 0xC1,       // CALL 0xC100
+    };
+    auto rom = make_rom(code);
+    // copy: LD DE, dst; LD C, 128, then a fused copy loop; RET
+    const uint8_t copy[] = {0x11, uint8_t(dst), uint8_t(dst >> 8), 0x0E, 0x80,
+                            0x2A, 0x12, 0x13, 0x0D, 0x20, 0xFA, 0xC9};
+    std::copy(std::begin(copy), std::end(copy), &rom[0x800]);
+    // two routines to copy to 0xC100: LD A, n; RET
+    std::fill(&rom[0x200], &rom[0x300], 0x00);
+    const uint8_t first[] = {0x3E, 0x11, 0xC9};
+    const uint8_t second[] = {0x3E, 0x22, 0xC9};
+    std::copy(std::begin(first), std::end(first), &rom[0x200 + before]);
+    std::copy(std::begin(second), std::end(second), &rom[0x280 + before]);
+
+    Machine fused(rom);
+    fused.enable_jit(jit);
+    Machine interpreted(rom);
+    disable_fusing(interpreted);
+    execute_until_halt(fused);
+    execute_until_halt(interpreted);
+    assert_same_state(fused, interpreted);
+    assert(fused.cpu.registers().b == 0x11 && fused.cpu.registers().accum == 0x22);
+}
+
+// watchpoints only fire on their own address and value, also for opcodes
+// fetched from decoded blocks, and the fast path returns once they are gone
+static void test_watchpoints(const bool jit)
+{
+    const auto rom = make_rom({
+        0x01, 0x00, 0x10,       // LD BC, 0x1000
+        0x00, 0x0B, 0x78, 0xB1, // NOP; DEC BC; LD A, B; OR C
+        0x20, 0xFA,             // JR NZ, -6
+    });
+    Machine machine(rom);
+    machine.enable_jit(jit);
+    auto& mem = machine.memory;
+    int fired = 0;
+    auto count = [&](Memory&, uint16_t, uint8_t) { fired++; };
+
+    mem.write8(0xC123, 0x01);
+    assert(mem.fast_page(Memory::WRITE, 0xC123));
+    mem.watchpoint(Memory::WRITE, 0xC123, count);
+    mem.watchpoint(Memory::WRITE, 0xC140, count, 0x42);
+    assert(!mem.fast_page(Memory::WRITE, 0xC123));
+    mem.write8(0xC123, 0x02);
+    assert(fired == 1);
+    mem.write8(0xC124, 0x02);
+    mem.write8(0xC140, 0x41);
+    assert(fired == 1);
+    mem.write8(0xC140, 0x42);
+    assert(fired == 2);
+    mem.clear_watchpoints();
+    assert(mem.fast_page(Memory::WRITE, 0xC123));
+    mem.write8(0xC123, 0x03);
+    assert(fired == 2);
+
+    // the loop is cached (and translated) before the NOP is watched
+    const uint16_t nop = CODE + 3;
+    execute_n(machine, 200);
+    const auto& regs = machine.cpu.registers();
+    assert(regs.bc != 0 && !machine.cpu.is_halting());
+    const int remaining = (regs.pc == nop + 1) ? regs.bc - 1 : regs.bc;
+    fired = 0;
+    mem.watchpoint(Memory::READ, nop, count);
+    execute_until_halt(machine);
+    assert(fired == remaining);
+}
+
+// writes only invalidate the code cached from the page they write to, so
+// variables next to the code in HRAM don't throw away the code in WRAM
+static void test_ram_code_pages()
+{
+    const auto rom = make_rom({0xC3, 0x00, 0xC0}); // JP 0xC000
+    Machine machine(rom);
+    // CALL 0xFF80; LD A, 0x42; HALT
+    const uint8_t wram[] = {0xCD, 0x80, 0xFF, 0x3E, 0x42, 0x76};
+    for (size_t i = 0; i < sizeof(wram); i++) machine.memory.write8(0xC000 + i, wram[i]);
+    machine.memory.write8(0xFF80, 0xC9); // RET
+    auto& cache = machine.cpu.block_cache();
+    execute_until_halt(machine);
+    assert(cache.code_page(0xC0) && cache.code_page(0xFF));
+    // only the RET block goes
+    const size_t blocks = cache.size();
+    machine.memory.write8(0xFF90, 0x42);
+    assert(cache.size() == blocks - 1);
+    assert(cache.code_page(0xC0) && !cache.code_page(0xFF));
+    assert(machine.memory.read8(0xFF90) == 0x42);
+
+    // writing over the code invalidates it
+    machine.memory.write8(0xC004, 0x24);
+    assert(!cache.code_page(0xC0));
+}
+
+// a new machine and a fork stay under 100kB, as RAM is only allocated when it
+// is written, and forks share it and start without cached tiles and code
+static void test_footprint()
+{
+    const auto rom = make_rom({0x21, 0x00, 0xC0, 0x36, 0x42}); // LD HL, 0xC000; LD (HL), 0x42
+    Machine machine(rom);
+    assert(machine.memory_footprint() < 100'000);
+    execute_until_halt(machine);
+    machine.gpu.render_frame();
+    assert(machine.gpu.tile_cache_footprint() > 0 && machine.cpu.block_cache().size() > 0);
+    auto fork = machine.fork();
+    assert(fork->memory_footprint() < 100'000);
+    assert(fork->gpu.tile_cache_footprint() == 0 && fork->cpu.block_cache().size() == 0);
+    assert(fork->memory.read8(0xC000) == 0x42);
+}
+
+// a fork continues like the original, and neither sees the other's writes
+static void test_fork()
+{
+    const auto rom = make_rom({
+        0xAF, 0xE0, 0x40,                         // XOR A; LDH (LCDC), A
+        0x21, 0x00, 0x10, 0x11, 0x00, 0xC0,       // LD HL, 0x1000; LD DE, 0xC000
+        0x01, 0x00, 0x10,                         // LD BC, 0x1000
+        0x2A, 0x12, 0x13, 0x0B, 0x78, 0xB1, 0x20, 0xF8,
+    });
+    Machine machine(rom);
+    execute_n(machine, 20);
+    assert(!machine.cpu.is_halting());
+    auto fork = machine.fork();
+    execute_until_halt(machine);
+    execute_until_halt(*fork);
+    assert_same_state(machine, *fork);
+
+    // Video RAM, work RAM, a page neither has written yet and high RAM
+    for (const uint16_t addr : {0x8000, 0xC100, 0xD800, 0xFF80})
+    {
+        const uint8_t value = machine.memory.read8(addr);
+        fork->memory.write8(addr, value ^ 0x5A);
+        assert(machine.memory.read8(addr) == value);
+        machine.memory.write8(addr, value ^ 0xA5);
+        assert(fork->memory.read8(addr) == (value ^ 0x5A));
+        assert(machine.memory.read8(addr) == (value ^ 0xA5));
+    }
+    // the original is unaffected by the fork going away
+    fork = nullptr;
+    assert(machine.memory.read8(0xC011) == rom[0x1011]);
+
+    // writes to either end of a 4kB page of work RAM, where the second one
+    // finds the page no longer shared
+    fork = machine.fork();
+    machine.memory.write8(0xCFF0, 0xA5);
+    fork->memory.write8(0xC010, 0x5A);
+    assert(machine.memory.read8(0xC010) == rom[0x1010] && machine.memory.read8(0xCFF0) == 0xA5);
+    assert(fork->memory.read8(0xC010) == 0x5A && fork->memory.read8(0xCFF0) == rom[0x1FF0]);
+}
+
+// restoring a full state and then the changes since an epoch gives the same
+// machine as the one they were taken from
+static void test_incremental_state()
+{
+    const auto rom = make_rom({
+        0x21, 0x00, 0x10, 0x11, 0x00, 0xC0,       // LD HL, 0x1000; LD DE, 0xC000
+        0x01, 0x00, 0x18,                         // LD BC, 0x1800
+        0x2A, 0x12, 0x13, 0x0B, 0x78, 0xB1, 0x20, 0xF8,
+    });
+    Machine machine(rom);
+    execute_n(machine, 20);
+    std::vector<uint8_t> state;
+    machine.serialize_state(state);
+    const uint32_t epoch = machine.new_epoch();
+    execute_n(machine, 20);
+    machine.memory.write8(0xFF80, 0x42);
+    std::vector<uint8_t> changes;
+    machine.serialize_changes(changes, epoch);
+    assert(changes.size() < state.size());
+
+    Machine restored(rom);
+    assert(restored.restore_state(state) == state.size());
+    assert(restored.restore_changes(changes) == changes.size());
+    assert_same_state(machine, restored);
+    execute_until_halt(machine);
+    execute_until_halt(restored);
+    assert_same_state(machine, restored);
+
+    // only whole blocks are restored, and anything shorter is an error
+    SharedPages<0x1000, 2> pages;
+    const uint32_t since = pages.next_epoch();
+    pages.write(0x1234, 0x56);
+    std::vector<uint8_t> blocks;
+    pages.serialize_changes(blocks, since);
+    assert(blocks.size() == 2 + 2 + pages.BLOCK_SIZE);
+    SharedPages<0x1000, 2> copy;
+    assert(copy.restore_changes(blocks, 0) == blocks.size());
+    assert(copy.read(0x1234) == 0x56 && copy.read(0x1233) == 0);
+    for (const size_t size : {size_t(0), size_t(1), blocks.size() - 1})
+    {
+        std::vector<uint8_t> truncated(blocks.begin(), blocks.begin() + size);
+        assert(throws_machine_exception([&] { copy.restore_changes(truncated, 0); }));
+    }
+}
+
+// without an MBC, cartridge RAM can't be disabled
+static void test_no_mbc()
+{
+    const auto rom = make_rom({}, 0x09, 0x02); // ROM+RAM+BATTERY, 8kB
+    Machine machine(rom);
+    machine.memory.write8(0x0000, 0x00);
+    machine.memory.write8(0x2000, 0x02);
+    machine.memory.write8(0xA000, 0x42);
+    assert(machine.memory.read8(0xA000) == 0x42);
+    assert(machine.memory.read8(0x4000) == rom[0x4000]);
+}
+
+// the MBC3 clock, counting emulated time
+static void test_rtc()
+{
+    const auto rom = make_rom({0x18, 0xFE}, 0x10, 0x03); // MBC3+TIMER+RAM+BATTERY, JR -2
+    Machine machine(rom);
+    constexpr uint64_t SECOND = 4194304;
+    auto run = [&](uint64_t seconds) {
+        const uint64_t until = machine.cpu.gettime() + seconds * SECOND;
+        while (machine.cpu.gettime() < until) machine.simulate();
+    };
+    auto write = [&](int reg, uint8_t value) {
+        machine.memory.write8(0x4000, 0x08 + reg);
+        machine.memory.write8(0xA000, value);
+    };
+    auto read = [&](int reg) {
+        machine.memory.write8(0x4000, 0x08 + reg);
+        return machine.memory.read8(0xA000);
+    };
+    auto latch = [&] {
+        machine.memory.write8(0x6000, 0x00);
+        machine.memory.write8(0x6000, 0x01);
+    };
+    machine.memory.write8(0x0000, 0x0A);
+    // the registers only change when latched
+    write(0, 0);
+    run(3);
+    assert(read(0) == 0);
+    latch();
+    assert(read(0) == 3);
+    // a halted clock doesn't count
+    write(4, 0x40);
+    run(2);
+    latch();
+    assert(read(0) == 3);
+    write(4, 0x00);
+    run(1);
+    latch();
+    assert(read(0) == 4);
+    // the 9-bit day counter sets the carry bit when it overflows, which stays
+    write(2, 23);
+    write(1, 59);
+    write(3, 0xFF);
+    write(4, 0x01);
+    write(0, 59);
+    run(1);
+    latch();
+    assert(read(0) == 0 && read(1) == 0 && read(2) == 0);
+    assert(read(3) == 0 && read(4) == 0x80);
+    run(1);
+    latch();
+    assert(read(0) == 1 && read(4) == 0x80);
+}
+
+// cartridge RAM kept in a battery save file, which only the original
+// machine writes to
+static void test_battery()
+{
+    char filename[] = "/tmp/gbc_battery_XXXXXX";
+    const int fd = mkstemp(filename);
+    assert(fd >= 0);
+    close(fd);
+    auto read_file = [&] {
+        std::ifstream file(filename, std::ios::binary);
+        return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), {});
+    };
+    const auto rom = make_rom({}, 0x03, 0x02); // MBC1+RAM+BATTERY, 8kB
+    {
+        Machine machine(rom);
+        auto& mbc = machine.memory.mbc();
+        // a new file gets the RAM as it is
+        machine.memory.write8(0x0000, 0x0A);
+        machine.memory.write8(0xA000, 0x11);
+        mbc.attach_battery(filename);
+        assert(mbc.has_battery());
+        auto file = read_file();
+        assert(file.size() == 0x2000 && file[0] == 0x11);
+        // writes are in the file once RAM is disabled
+        machine.memory.write8(0xA123, 0x22);
+        machine.memory.write8(0x0000, 0x00);
+        assert(read_file()[0x123] == 0x22);
+
+        // a fork writes to its own copy
+        auto fork = machine.fork();
+        assert(!fork->memory.mbc().has_battery());
+        fork->memory.write8(0x0000, 0x0A);
+        assert(fork->memory.read8(0xA123) == 0x22);
+        fork->memory.write8(0xA123, 0x33);
+        fork->memory.write8(0x0000, 0x00);
+        assert(read_file()[0x123] == 0x22);
+        machine.memory.write8(0x0000, 0x0A);
+        assert(machine.memory.read8(0xA123) == 0x22);
+    }
+    // an existing file is loaded
+    {
+        Machine machine(rom);
+        machine.memory.mbc().attach_battery(filename);
+        machine.memory.write8(0x0000, 0x0A);
+        assert(machine.memory.read8(0xA000) == 0x11 && machine.memory.read8(0xA123) == 0x22);
+    }
+    // cartridge RAM without a battery
+    const auto plain_rom = make_rom({}, 0x02, 0x02); // MBC1+RAM
+    Machine plain(plain_rom);
+    assert(throws_machine_exception([&] { plain.memory.mbc().attach_battery(filename); }));
+    unlink(filename);
+}
+
+// a compressed image decompresses to the same banks, and machines read the
+// same through them, also when switching between more banks than are cached
+static void test_compressed_rom()
+{
+    auto image = make_rom({}, 0x19); // MBC5
+    image.resize(32 * Rom::BANK_SIZE);
+    image[0x148] = 0x04; // 512kB
+    uint8_t checksum = 0;
+    for (int i = 0x134; i < 0x14D; i++) checksum = checksum - image[i] - 1;
+    image[0x14D] = checksum;
+    // empty, repetitive and incompressible banks
+    uint32_t seed = 1;
+    for (size_t i = 2 * Rom::BANK_SIZE; i < image.size(); i++)
+    {
+        const size_t bank = i / Rom::BANK_SIZE;
+        seed = seed * 1103515245 + 12345;
+        image[i] = (bank % 3 == 0) ? 0 : (bank % 3 == 1) ? i / 7 : seed >> 16;
+    }
+    const std::string_view view{(const char*) image.data(), image.size()};
+    const auto compressed = Rom::compress(view);
+    assert(compressed.size() < image.size());
+    const auto plain = Rom::copy(view);
+    const auto rom = Rom::copy({(const char*) compressed.data(), compressed.size()});
+    assert(rom->compressed() && !plain->compressed());
+    assert(rom->size() == plain->size() && rom->banks() == plain->banks());
+    assert(rom->title() == plain->title() && rom->cartridge_type() == plain->cartridge_type());
+    Rom::bank_t bank;
+    for (size_t n = 0; n < rom->banks(); n++)
+    {
+        rom->decompress(n, bank);
+        assert(std::equal(bank.begin(), bank.end(), plain->bank(n)));
+    }
+
+    Machine a(plain);
+    Machine b(rom);
+    for (const int n : {1, 2, 3, 31, 4, 5, 6, 7, 8, 9, 10, 2, 30, 17, 1, 31})
+    {
+        a.memory.write8(0x2000, n);
+        b.memory.write8(0x2000, n);
+        for (int addr = 0x0000; addr < 0x8000; addr += 0x40)
+            assert(a.memory.read8(addr) == b.memory.read8(addr));
+        assert(b.memory.read8(0x4000 + n) == image[n * Rom::BANK_SIZE + n]);
+    }
+
+    // damaged images and invalid headers are rejected
+    auto truncated = compressed;
+    truncated.resize(truncated.size() / 2);
+    assert(throws_machine_exception(
+        [&] { Rom::copy({(const char*) truncated.data(), truncated.size()}); }));
+    image[0x14D]++;
+    assert(throws_machine_exception([&] { Rom::compress(view); }));
+    // views aren't checked, but don't read a header past the end of the image
+    const std::vector<uint8_t> header(image.begin(), image.begin() + 0x140);
+    const auto stub = Rom::view({(const char*) header.data(), header.size()});
+    assert(stub->title().empty() && stub->cartridge_type() == 0);
+}
+
+// the vector compositor matches the scalar one on random scanlines, for every
+// combination of the layers and their priority bits
+static void test_compositor()
+{
+    uint32_t seed = 1;
+    auto next = [&] {
+        seed = seed * 1103515245 + 12345;
+        return uint8_t(seed >> 16);
+    };
+    GPU::scanline_t line;
+    for (int n = 0; n < 200; n++)
+    {
+        for (int x = 0; x < GPU::SCREEN_W; x++)
+        {
+            line.bg_colors[x] = next() & 0x3;
+            line.bg_attrs[x] = next();
+            line.colors[x] = next() & 0x3;
+            line.attrs[x] = next();
+            line.sprite_colors[x] = next() & 0x3;
+            line.sprite_attrs[x] = next();
+        }
+        const sprite_config_t sconf{{nullptr, nullptr}, {next(), next()}, 0, 0, 8, n % 2 == 0};
+        const tileconf_t tconf{n % 2 == 0, next()};
+        std::array<uint8_t, GPU::SCREEN_W> vector, scalar;
+        GPU::compose_indices(line, tconf, sconf, vector.data());
+        GPU::compose_indices_scalar(line, tconf, sconf, scalar.data());
+        assert(vector == scalar);
+    }
+}
+
+// one scanline with sprites overlapping each other and the background, where
+// every palette index is its own color, so that the pixels are the indices
+static std::array<uint8_t, GPU::SCREEN_W> render_sprites(Machine& machine,
+                                                        const std::vector<uint8_t>& oam)
+{
+    auto& mem = machine.memory;
+    // tile 1 is color 3, tile 2 is color 1 and tile 3 is color 2
+    for (int y = 0; y < 8; y++)
+    {
+        mem.write8(0x8010 + 2 * y, 0xFF);
+        mem.write8(0x8011 + 2 * y, 0xFF);
+        mem.write8(0x8020 + 2 * y, 0xFF);
+        mem.write8(0x8031 + 2 * y, 0xFF);
+    }
+    // the BG is color 0, except from x=16 to x=23
+    mem.write8(0x9802, 0x01);
+    for (size_t i = 0; i < oam.size(); i++) mem.write8(0xFE00 + i, oam[i]);
+    mem.write8(IO::REG_BGP, 0xE4);
+    mem.write8(IO::REG_OBP0, 0xE4);
+    mem.write8(IO::REG_OBP1, 0xE4);
+    for (int i = 0; i < GPU::NUM_PALETTES; i++)
+    {
+        machine.gpu.getpal(2 * i) = i;
+        machine.gpu.getpal(2 * i + 1) = 0;
+    }
+    mem.write8(IO::REG_LCDC, 0x93); // with sprites
+    machine.gpu.render_frame();
+    std::array<uint8_t, GPU::SCREEN_W> line;
+    for (int x = 0; x < GPU::SCREEN_W; x++) line[x] = machine.gpu.pixels()[x];
+    return line;
+}
+
+// the sprite with the lowest X wins on DMG, and then the first in OAM, while
+// on CGB the first in OAM always wins, and behind the BG they only show on
+// BG color 0
+static void test_sprite_priority()
+{
+    // Y, X, tile, attributes
+    const std::vector<uint8_t> oam{
+        16, 12, 3, 0x00, // color 2 from x=4 to x=11
+        16, 10, 2, 0x00, // color 1 from x=2 to x=9
+        16, 40, 3, 0x00, // color 2 from x=32 to x=39
+        16, 40, 2, 0x00, // color 1 from x=32 to x=39
+        16, 24, 2, 0x80, // behind BG color 3 from x=16 to x=23
+        16, 60, 2, 0x80, // behind BG color 0 from x=52 to x=59
+    };
+    const auto dmg_rom = make_rom({});
+    Machine dmg(dmg_rom);
+    assert(!dmg.is_cgb());
+    const auto dmg_line = render_sprites(dmg, oam);
+    assert(dmg_line[0] == 0 && dmg_line[2] == 1 && dmg_line[9] == 1 && dmg_line[10] == 2);
+    assert(dmg_line[32] == 2 && dmg_line[39] == 2);
+    assert(dmg_line[16] == 3 && dmg_line[23] == 3 && dmg_line[52] == 1);
+    // only the tiles of VRAM bank 0 were decoded
+    assert(dmg.gpu.tile_cache_footprint() == TileCache::TILES * 8 * sizeof(uint64_t));
+
+    // CGB indices are 4 * palette + color, with the sprite palettes from 32
+    auto cgb_oam = oam;
+    cgb_oam[3] = 0x01;
+    cgb_oam[7] = 0x02;
+    const auto cgb_rom = make_rom({}, 0, 0, true);
+    Machine cgb(cgb_rom);
+    assert(cgb.is_cgb());
+    // the BG attribute priority bit covers sprites from x=24 to x=31
+    cgb.memory.write8(IO::REG_VBK, 1);
+    cgb.memory.write8(0x9803, 0x80);
+    cgb.memory.write8(IO::REG_VBK, 0);
+    cgb.memory.write8(0x9803, 0x01);
+    cgb_oam.insert(cgb_oam.end(), {16, 32, 2, 0x00});
+    const auto cgb_line = render_sprites(cgb, cgb_oam);
+    assert(cgb_line[0] == 0 && cgb_line[2] == 41 && cgb_line[9] == 38 && cgb_line[10] == 38);
+    assert(cgb_line[32] == 34 && cgb_line[39] == 34);
+    assert(cgb_line[16] == 3 && cgb_line[23] == 3 && cgb_line[52] == 33);
+    assert(cgb_line[24] == 3 && cgb_line[31] == 3);
+}
+
 void do_test_machine()
 {
     test_alu();
+    test_fused_loops();
+    for (uint8_t before = 1; before < 0x40; before++)
+    {
+        test_fused_copy_over_code(false, before);
+        test_fused_copy_over_code(true, before);
+    }
+    test_ram_code_pages();
+    test_watchpoints(false);
+    test_watchpoints(true);
+    test_footprint();
+    test_fork();
+    test_incremental_state();
+    test_no_mbc();
+    test_rtc();
+    test_battery();
+    test_compressed_rom();
+    test_compositor();
+    test_sprite_priority();
 
     printf("Tests SUCCESS!\n");
     exit(0);
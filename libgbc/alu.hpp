@@ -0,0 +1,128 @@
+#pragma once
+#include "registers.hpp"
+#include <array>
+#include <cstdint>
+
+// Result and flag tables for the 8-bit ALU, DAA and the CB rotate family,
+// generated at compile time from the reference implementations below.
+namespace gbc
+{
+struct alu_result_t
+{
+    uint8_t value;
+    uint8_t flags;
+};
+
+// flags of ADD (sub = false) and SUB/CP (sub = true)
+constexpr uint8_t alu_flags(const bool sub, const uint8_t a, const uint8_t v)
+{
+    uint8_t f = 0;
+    if (!sub)
+    {
+        if (((a & 0xf) + (v & 0xf)) & 0x10) f |= MASK_HALFCARRY;
+        if ((a + v) & 0x100) f |= MASK_CARRY;
+        if (uint8_t(a + v) == 0) f |= MASK_ZERO;
+        return f;
+    }
+    f = MASK_NEGATIVE;
+    if ((a & 0xf) < (v & 0xf)) f |= MASK_HALFCARRY;
+    if (a < v) f |= MASK_CARRY;
+    if (a == v) f |= MASK_ZERO;
+    return f;
+}
+constexpr size_t alu_index(const bool sub, const uint8_t a, const uint8_t v)
+{
+    return (sub << 16) | (a << 8) | v;
+}
+
+// DAA only looks at N, H and C of the incoming flags
+constexpr alu_result_t daa(uint8_t a, const uint8_t flags)
+{
+    uint8_t f = flags & (MASK_NEGATIVE | MASK_CARRY);
+    if (flags & MASK_NEGATIVE)
+    {
+        if (flags & MASK_CARRY) a -= 0x60;
+        if (flags & MASK_HALFCARRY) a -= 0x06;
+    }
+    else
+    {
+        if ((flags & MASK_CARRY) || a > 0x99)
+        {
+            a += 0x60;
+            f |= MASK_CARRY;
+        }
+        if ((flags & MASK_HALFCARRY) || (a & 0xF) > 0x9) a += 0x06;
+    }
+    if (a == 0) f |= MASK_ZERO;
+    return {a, f};
+}
+constexpr size_t daa_index(const uint8_t a, const uint8_t flags)
+{
+    return (((flags >> 4) & 0x7) << 8) | a;
+}
+
+// RLC, RRC, RL, RR, SLA, SRA, SWAP and SRL, in CB opcode order
+constexpr alu_result_t rotate(const uint8_t op, const uint8_t v, const bool carry)
+{
+    uint8_t r = 0;
+    bool c = false;
+    switch (op & 0x7)
+    {
+    case 0x0: // RLC
+        r = (v << 1) | (v >> 7);
+        c = v & 0x80;
+        break;
+    case 0x1: // RRC
+        r = (v >> 1) | (v << 7);
+        c = v & 0x1;
+        break;
+    case 0x2: // RL
+        r = (v << 1) | carry;
+        c = v & 0x80;
+        break;
+    case 0x3: // RR
+        r = (v >> 1) | (carry << 7);
+        c = v & 0x1;
+        break;
+    case 0x4: // SLA
+        r = v << 1;
+        c = v & 0x80;
+        break;
+    case 0x5: // SRA
+        r = (v >> 1) | (v & 0x80);
+        c = v & 0x1;
+        break;
+    case 0x6: // SWAP
+        r = (v >> 4) | (v << 4);
+        break;
+    case 0x7: // SRL
+        r = v >> 1;
+        c = v & 0x1;
+        break;
+    }
+    return {r, uint8_t((r == 0 ? MASK_ZERO : 0) | (c ? MASK_CARRY : 0))};
+}
+constexpr size_t rotate_index(const uint8_t op, const uint8_t v, const bool carry)
+{
+    return ((op & 0x7) << 9) | (carry << 8) | v;
+}
+
+inline constexpr auto DAA_TABLE = [] {
+    std::array<alu_result_t, 8 * 256> table{};
+    for (size_t i = 0; i < table.size(); i++) table[i] = daa(i & 0xFF, (i >> 8) << 4);
+    return table;
+}();
+inline constexpr auto ROTATE_TABLE = [] {
+    std::array<alu_result_t, 8 * 2 * 256> table{};
+    for (size_t i = 0; i < table.size(); i++) table[i] = rotate(i >> 9, i & 0xFF, (i >> 8) & 1);
+    return table;
+}();
+// 128kB is more than some compilers will evaluate as a constant, so
+// ALU_FLAGS (see registers.hpp) may be filled in at startup instead
+constexpr std::array<uint8_t, 2 * 256 * 256> make_alu_flags()
+{
+    std::array<uint8_t, 2 * 256 * 256> table{};
+    for (size_t i = 0; i < table.size(); i++) table[i] = alu_flags(i >> 16, i >> 8, i);
+    return table;
+}
+} // namespace gbc
@@ -9,11 +9,20 @@ APU::APU(Machine& mach) : m_machine{mach} {}
 
 void APU::simulate()
 {
+    this->reschedule();
     // if sound is off, don't do anything
     if ((machine().io.reg(IO::REG_NR52) & 0x80) == 0) return;
 
     // TODO: writeme
 }
+void APU::reschedule()
+{
+    // the frame sequencer is clocked at 512 Hz
+    static constexpr uint64_t SEQUENCER_CYCLES = 8192;
+    const uint64_t now = machine().now();
+    const uint64_t next = now + SEQUENCER_CYCLES - now % SEQUENCER_CYCLES;
+    machine().scheduler.schedule(Scheduler::APU_EVENT, next);
+}
 
 uint8_t APU::read(const uint16_t addr, uint8_t& reg)
 {
@@ -13,7 +13,9 @@ public:
     using audio_stream_t = std::function<void(uint16_t, uint16_t)>;
 
     void on_audio_out(audio_stream_t);
+    // scheduler event: one step of the frame sequencer
     void simulate();
+    void reschedule();
 
     uint8_t read(uint16_t, uint8_t& reg);
     void write(uint16_t, uint8_t, uint8_t& reg);
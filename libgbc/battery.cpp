@@ -0,0 +1,97 @@
+#include "mbc.hpp"
+#include "memory.hpp"
+#include <algorithm>
+
+#ifdef __unix__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace gbc
+{
+// a battery save file, mapped shared so that writes land in the file
+struct MBC::battery_t
+{
+    uint8_t* data;
+    size_t size;
+    ~battery_t()
+    {
+#ifdef __unix__
+        munmap(data, size);
+#endif
+    }
+};
+
+static bool cartridge_battery(const uint8_t type) noexcept
+{
+    switch (type)
+    {
+    case 0x03: // MBC1+RAM+BATTERY
+    case 0x06: // MBC2+BATTERY
+    case 0x09: // ROM+RAM+BATTERY
+    case 0x0D: // MMM01+RAM+BATTERY
+    case 0x0F: // MBC3+TIMER+BATTERY
+    case 0x10: // MBC3+TIMER+RAM+BATTERY
+    case 0x13: // MBC3+RAM+BATTERY
+    case 0x1B: // MBC5+RAM+BATTERY
+    case 0x1E: // MBC5+RUMBLE+RAM+BATTERY
+        return true;
+    }
+    return false;
+}
+
+void MBC::attach_battery(const std::string& filename)
+{
+    if (m_state.ram_bank_size == 0 || !cartridge_battery(m_rom.cartridge_type()))
+        throw MachineException("MBC: Cartridge has no battery-backed RAM");
+#ifdef __unix__
+    const int fd = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) throw MachineException("MBC: Could not open battery file");
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        ::close(fd);
+        throw MachineException("MBC: Could not read battery file size");
+    }
+    const bool fresh = st.st_size == 0;
+    if ((size_t) st.st_size < m_state.ram_bank_size && ftruncate(fd, m_state.ram_bank_size) < 0)
+    {
+        ::close(fd);
+        throw MachineException("MBC: Could not resize battery file");
+    }
+    // whole RAM pages, where the file can end in the middle of the last one
+    const size_t pages = (m_state.ram_bank_size + m_ram.PAGE_SIZE - 1) / m_ram.PAGE_SIZE;
+    const size_t size = pages * m_ram.PAGE_SIZE;
+    void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) throw MachineException("MBC: Unable to map battery file");
+
+    auto battery = std::make_shared<battery_t>();
+    battery->data = (uint8_t*) data;
+    battery->size = size;
+    const size_t first = CART_RAM / m_ram.PAGE_SIZE;
+    for (size_t n = 0; n < pages; n++)
+    {
+        uint8_t* page = battery->data + n * m_ram.PAGE_SIZE;
+        // a new file starts out with the RAM as it is
+        if (fresh) std::copy_n(m_ram.page(first + n), m_ram.PAGE_SIZE, page);
+        m_ram.attach(first + n, (decltype(m_ram)::page_t*) page, battery);
+    }
+    this->m_battery = std::move(battery);
+    this->m_memory.remap(Memory::BankRAM);
+#else
+    (void) filename;
+    throw MachineException("MBC: Battery files are not supported on this platform");
+#endif
+}
+
+void MBC::sync_battery()
+{
+#ifdef __unix__
+    // schedule the write-back without waiting for it
+    if (m_battery != nullptr) msync(m_battery->data, m_battery->size, MS_ASYNC);
+#endif
+}
+} // namespace gbc
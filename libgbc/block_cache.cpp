@@ -0,0 +1,453 @@
+#include "block_cache.hpp"
+
+#include "machine.hpp"
+#include <algorithm>
+#include <iterator>
+
+namespace gbc
+{
+// instruction lengths, where 0 is an undefined opcode
+static constexpr uint8_t OPCODE_LENGTH[256] = {
+    1, 3, 1, 1, 1, 1, 2, 1, 3, 1, 1, 1, 1, 1, 2, 1, // 0x00
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1, // 0x10
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1, // 0x20
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1, // 0x30
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x40
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x50
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x60
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x70
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x80
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x90
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0xA0
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0xB0
+    1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 2, 3, 3, 2, 1, // 0xC0
+    1, 1, 3, 0, 3, 1, 2, 1, 1, 1, 3, 0, 3, 0, 2, 1, // 0xD0
+    2, 1, 1, 0, 0, 1, 2, 1, 2, 1, 3, 0, 0, 0, 2, 1, // 0xE0
+    2, 1, 1, 1, 0, 1, 2, 1, 2, 1, 3, 1, 0, 0, 2, 1, // 0xF0
+};
+// T-states when conditional branches are not taken
+static constexpr uint8_t OPCODE_CYCLES[256] = {
+    4,  12, 8,  8,  4,  4,  8,  4,  20, 8,  8,  8,  4,  4,  8,  4,  // 0x00
+    4,  12, 8,  8,  4,  4,  8,  4,  12, 8,  8,  8,  4,  4,  8,  4,  // 0x10
+    8,  12, 8,  8,  4,  4,  8,  4,  8,  8,  8,  8,  4,  4,  8,  4,  // 0x20
+    8,  12, 8,  8,  12, 12, 12, 4,  8,  8,  8,  8,  4,  4,  8,  4,  // 0x30
+    4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,  // 0x40
+    4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,  // 0x50
+    4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,  // 0x60
+    8,  8,  8,  8,  8,  8,  4,  8,  4,  4,  4,  4,  4,  4,  8,  4,  // 0x70
+    4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,  // 0x80
+    4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,  // 0x90
+    4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,  // 0xA0
+    4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,  // 0xB0
+    8,  12, 12, 16, 12, 16, 8,  16, 8,  16, 12, 8,  12, 24, 8,  16, // 0xC0
+    8,  12, 12, 0,  12, 16, 8,  16, 8,  16, 12, 0,  12, 0,  8,  16, // 0xD0
+    12, 12, 8,  0,  0,  16, 8,  16, 16, 4,  16, 0,  0,  0,  8,  16, // 0xE0
+    12, 12, 8,  4,  0,  16, 8,  16, 12, 8,  16, 4,  0,  0,  8,  16, // 0xF0
+};
+
+static bool ends_block(const uint8_t opcode) noexcept
+{
+    switch (opcode)
+    {
+    case 0x10: // STOP
+    case 0x76: // HALT
+    case 0x18: // JR
+    case 0x20:
+    case 0x28:
+    case 0x30:
+    case 0x38:
+    case 0xC2: // JP
+    case 0xC3:
+    case 0xCA:
+    case 0xD2:
+    case 0xDA:
+    case 0xE9:
+    case 0xC4: // CALL
+    case 0xCC:
+    case 0xCD:
+    case 0xD4:
+    case 0xDC:
+    case 0xC0: // RET
+    case 0xC8:
+    case 0xC9:
+    case 0xD0:
+    case 0xD8:
+    case 0xD9:
+        return true;
+    }
+    // RST
+    return (opcode & 0xC7) == 0xC7;
+}
+
+// memory that only changes on device events (or CPU writes)
+static bool pollable(const uint16_t addr) noexcept
+{
+    // cartridge RAM can be an RTC, joypad reads have callbacks, and DIV always counts
+    if (addr >= 0xA000 && addr < 0xC000) return false;
+    return addr != IO::REG_P1 && addr != IO::REG_DIV;
+}
+
+// Loops that reload A from memory, test it and branch back to their start
+// until the value changes, eg. LDH A, (LY); CP 144; JR NZ. All they change
+// is A and flags, which are recomputed from the memory value each time.
+static bool is_idle_loop(const block_t& block)
+{
+    const auto& last = block.instr.back();
+    const uint8_t op = last.opcode();
+    const uint16_t head = block.instr.front().pc;
+    uint16_t dest;
+    if (op == 0x18 || (op & 0xE7) == 0x20)
+        dest = last.pc + 2 + (int8_t) last.bytes[1];
+    else if (op == 0xC3 || (op & 0xE7) == 0xC2)
+        dest = last.bytes[1] | (last.bytes[2] << 8);
+    else
+        return false;
+    if (dest != head) return false;
+
+    // registers and flags must be written before they are read
+    bool a_defined = false, z_defined = false, c_defined = false;
+    for (size_t i = 0; i + 1 < block.instr.size(); i++)
+    {
+        const auto& instr = block.instr[i];
+        const uint8_t opcode = instr.opcode();
+        switch (opcode)
+        {
+        case 0x00: // NOP
+            continue;
+        case 0xF0: // LD A, (FF00+imm8)
+            if (!pollable(0xFF00 | instr.bytes[1])) return false;
+            a_defined = true;
+            continue;
+        case 0xFA: // LD A, (imm16)
+            if (!pollable(instr.bytes[1] | (instr.bytes[2] << 8))) return false;
+            a_defined = true;
+            continue;
+        case 0xF2: // LD A, (FF00+C)
+        case 0x0A: // LD A, (BC)
+        case 0x1A: // LD A, (DE)
+        case 0x7E: // LD A, (HL)
+            // address is checked by idle_loop_ready()
+        case 0x3E: // LD A, imm8
+        case 0x78: // LD A, B..L
+        case 0x79:
+        case 0x7A:
+        case 0x7B:
+        case 0x7C:
+        case 0x7D:
+            a_defined = true;
+            continue;
+        case 0x3C: // INC A, DEC A
+        case 0x3D:
+            if (!a_defined) return false;
+            z_defined = true;
+            continue;
+        case 0xCB:
+        {
+            // BIT b, D
+            const uint8_t cb = instr.bytes[1];
+            if ((cb & 0xC0) != 0x40 || (cb & 0x7) == 0x6) return false;
+            if ((cb & 0x7) == 0x7 && !a_defined) return false;
+            z_defined = true;
+            continue;
+        }
+        }
+        // ALU A, D and ALU A, imm8
+        if ((opcode >= 0x80 && opcode < 0xC0 && (opcode & 0x7) != 0x6) || (opcode & 0xC7) == 0xC6)
+        {
+            const uint8_t alu = (opcode >> 3) & 0x7;
+            if (!a_defined) return false;
+            if ((alu == ADC || alu == SBC) && !c_defined) return false;
+            z_defined = c_defined = true;
+            continue;
+        }
+        return false;
+    }
+    // JR and JP without conditions spin until an interrupt
+    if (op == 0x18 || op == 0xC3) return true;
+    return (op & 0x10) ? c_defined : z_defined;
+}
+
+// Copy, fill and delay loops that count a register down to zero, eg.
+// LD A, (HL+); LD (DE), A; INC DE; DEC B; JR NZ
+static fused_loop_t fuse_loop(const block_t& block, const bool in_rom)
+{
+    const auto& instr = block.instr;
+    const auto& last = instr.back();
+    if (last.opcode() != 0x20 || uint16_t(last.pc + 2 + (int8_t) last.bytes[1]) != instr[0].pc)
+        return {};
+    fused_loop_t loop;
+    size_t i = 0;
+    const uint8_t op = instr[0].opcode();
+    if ((op == 0x2A || op == 0x3A) && instr.size() >= 4 && instr[1].opcode() == 0x12 &&
+        instr[2].opcode() == 0x13)
+    {
+        loop.kind = fused_loop_t::COPY;
+        loop.step = (op == 0x2A) ? 1 : -1;
+        i = 3;
+    }
+    else if (op == 0x22 || op == 0x32)
+    {
+        loop.kind = fused_loop_t::FILL;
+        loop.step = (op == 0x22) ? 1 : -1;
+        i = 1;
+    }
+    else
+    {
+        loop.kind = fused_loop_t::DELAY;
+    }
+    // memory writes from RAM could be overwriting the loop itself
+    if (loop.kind != fused_loop_t::DELAY && !in_rom) return {};
+
+    // the counter: DEC r or DEC rr; LD A, hi; OR lo
+    const size_t remaining = instr.size() - 1 - i;
+    const uint8_t dec = instr[i].opcode();
+    if (remaining == 1 && (dec & 0xC7) == 0x05 && dec != 0x35)
+    {
+        loop.counter = dec >> 3;
+        // COPY uses A, DE and HL, and FILL uses A and HL
+        if (loop.kind == fused_loop_t::COPY && loop.counter > 1) return {};
+        if (loop.kind == fused_loop_t::FILL && loop.counter > 3) return {};
+    }
+    else if (remaining == 3 && (dec == 0x0B || dec == 0x1B) && loop.kind != fused_loop_t::FILL)
+    {
+        // LD A, B; OR C or LD A, D; OR E
+        const uint8_t hi = (dec == 0x0B) ? 0x78 : 0x7A;
+        const uint8_t lo = (dec == 0x0B) ? 0xB1 : 0xB3;
+        if (instr[i + 1].opcode() != hi || instr[i + 2].opcode() != lo) return {};
+        loop.counter = dec >> 4;
+        loop.wide = true;
+        if (loop.kind == fused_loop_t::COPY && loop.counter != 0) return {};
+    }
+    else
+        return {};
+
+    // the branch back is taken on every iteration but the last
+    unsigned period = 4;
+    for (const auto& in : instr) period += in.cycles;
+    loop.period = period;
+    return loop;
+}
+
+bool BlockCache::idle_loop_ready(const block_t& block) const
+{
+    const auto& regs = m_cpu.registers();
+    for (const auto& instr : block.instr)
+    {
+        switch (instr.opcode())
+        {
+        case 0xF2:
+            if (!pollable(0xFF00 | regs.c)) return false;
+            break;
+        case 0x0A:
+            if (!pollable(regs.bc)) return false;
+            break;
+        case 0x1A:
+            if (!pollable(regs.de)) return false;
+            break;
+        case 0x7E:
+            if (!pollable(regs.hl)) return false;
+            break;
+        }
+    }
+    return true;
+}
+
+BlockCache::BlockCache(CPU& cpu) : m_cpu(cpu) {}
+
+const decoded_t* BlockCache::fetch(const uint16_t pc)
+{
+    // memory read breakpoints must see every opcode fetch
+    if (UNLIKELY(m_cpu.memory().has_read_breakpoints())) return m_current = nullptr;
+    // continue along the current block
+    if (const decoded_t* instr = this->follow(pc)) return instr;
+    uint32_t key, end;
+    if (UNLIKELY(!this->cache_key(pc, key, end)))
+    {
+        m_block = nullptr;
+        return m_current = nullptr;
+    }
+    block_t*& slot = m_lookup[lookup_index(key)];
+    if (slot == nullptr || slot->key != key)
+    {
+        auto it = m_blocks.find(key);
+        if (it != m_blocks.end())
+            slot = &it->second;
+        else
+        {
+            block_t* block = this->decode_block(key, pc, end);
+            if (block == nullptr)
+            {
+                m_block = nullptr;
+                return m_current = nullptr;
+            }
+            slot = block;
+        }
+    }
+    m_block = slot;
+    m_index = 1;
+    return m_current = &m_block->instr[0];
+}
+
+void BlockCache::resume(block_t& block, const uint16_t pc) noexcept
+{
+    this->leave();
+    for (size_t i = 0; i < block.instr.size(); i++)
+    {
+        if (block.instr[i].pc == pc)
+        {
+            m_block = &block;
+            m_index = i;
+            return;
+        }
+    }
+}
+
+bool BlockCache::cache_key(const uint16_t pc, uint32_t& key, uint32_t& end) const
+{
+    // RAM blocks are tagged with the top bit
+    static const uint32_t RAM_TAG = 0x80000000;
+    const auto& memory = m_cpu.memory();
+    switch (pc & 0xF000)
+    {
+    case 0x0000:
+    case 0x1000:
+    case 0x2000:
+    case 0x3000:
+        key = pc;
+        end = std::min(size_t(0x4000), memory.rom_size());
+        return true;
+    case 0x4000:
+    case 0x5000:
+    case 0x6000:
+    case 0x7000:
+    {
+        const uint32_t offset = memory.mbc().rombank_offset();
+        key = (offset << 2) | pc; // bank number << 16
+        if (memory.rom_size() < offset + 0x4000) return false;
+        end = 0x8000;
+        return true;
+    }
+    case 0xC000:
+        key = RAM_TAG | pc;
+        end = 0xD000;
+        return true;
+    case 0xD000:
+        key = RAM_TAG | (memory.mbc().wrambank_offset() << 4) | pc;
+        end = 0xE000;
+        return true;
+    case 0xF000:
+        if (pc < Memory::ZRAM.first) return false;
+        key = RAM_TAG | pc;
+        end = Memory::InterruptEn;
+        return true;
+    }
+    return false;
+}
+
+block_t* BlockCache::decode_block(const uint32_t key, const uint16_t pc, const uint32_t end)
+{
+    auto& memory = m_cpu.memory();
+    block_t block;
+    block.key = key;
+    uint32_t addr = pc;
+    while (block.instr.size() < MAX_BLOCK_INSTR)
+    {
+        // opcode fetches from watched pages must reach the watchpoints
+        if (UNLIKELY(memory.watched_page(Memory::READ, addr))) break;
+        const uint8_t opcode = memory.read8(addr);
+        const uint8_t length = OPCODE_LENGTH[opcode];
+        // undefined opcodes take the slow path
+        if (length == 0 || addr + length > end) break;
+        if (UNLIKELY(memory.watched_page(Memory::READ, addr + length - 1))) break;
+
+        decoded_t instr{m_cpu.decode(opcode).handler, (uint16_t) addr, length,
+                        OPCODE_CYCLES[opcode], {opcode, 0, 0}};
+        const int count = std::min<int>(length, std::size(instr.bytes));
+        for (int i = 1; i < count; i++) instr.bytes[i] = memory.read8(addr + i);
+        if (opcode == 0xCB)
+        {
+            // (HL) variants read and write memory
+            const uint8_t cb = instr.bytes[1];
+            instr.handler = m_cpu.decode_cb(cb);
+            instr.cycles = ((cb & 0x7) != 0x6) ? 8 : ((cb >> 6) == 0x1) ? 12 : 16;
+        }
+        block.instr.push_back(instr);
+        addr += length;
+        if (ends_block(opcode)) break;
+    }
+    if (block.instr.empty()) return nullptr;
+    block.idle_loop = is_idle_loop(block);
+    block.fused = fuse_loop(block, (key & 0x80000000) == 0);
+
+    if (key & 0x80000000)
+    {
+        for (uint32_t page = pc >> 8; page <= (addr - 1) >> 8; page++)
+            m_page_blocks[page].push_back(key);
+        // writes to these pages must now go through the slow path
+        memory.remap({pc, uint16_t(addr - 1)});
+    }
+    auto it = m_blocks.emplace(key, std::move(block));
+    return &it.first->second;
+}
+
+void BlockCache::flush_page(const uint8_t page)
+{
+    const auto keys = std::move(m_page_blocks[page]);
+    m_page_blocks[page].clear();
+    for (const uint32_t key : keys)
+    {
+        auto it = m_blocks.find(key);
+        if (it == m_blocks.end()) continue;
+        // blocks that cross into the next page are listed there too
+        const auto& last = it->second.instr.back();
+        const unsigned end = (last.pc + last.length - 1) >> 8;
+        for (unsigned other = it->second.instr.front().pc >> 8; other <= end; other++)
+        {
+            auto& list = m_page_blocks[other];
+            list.erase(std::remove(list.begin(), list.end(), key), list.end());
+        }
+        block_t*& slot = m_lookup[lookup_index(key)];
+        if (slot == &it->second) slot = nullptr;
+        m_blocks.erase(it);
+    }
+    // writes to the page can take the fast path again
+    m_cpu.memory().remap({uint16_t(page << 8), uint16_t((page << 8) | 0xFF)});
+    this->leave();
+}
+void BlockCache::flush_ram()
+{
+    for (auto it = m_blocks.begin(); it != m_blocks.end();)
+    {
+        if (it->first & 0x80000000)
+            it = m_blocks.erase(it);
+        else
+            ++it;
+    }
+    m_lookup.fill(nullptr);
+    for (auto& list : m_page_blocks) list.clear();
+    m_cpu.memory().remap(Memory::WorkRAM);
+    this->leave();
+}
+void BlockCache::flush()
+{
+    m_blocks.clear();
+    m_lookup.fill(nullptr);
+    for (auto& list : m_page_blocks) list.clear();
+    m_cpu.memory().remap(Memory::WorkRAM);
+    this->leave();
+    m_generation++;
+}
+
+size_t BlockCache::footprint() const noexcept
+{
+    size_t bytes = m_blocks.bucket_count() * sizeof(void*);
+    for (const auto& it : m_blocks)
+    {
+        const block_t& block = it.second;
+        bytes += sizeof(it) + sizeof(void*); // node
+        bytes += block.instr.capacity() * sizeof(decoded_t);
+        bytes += block.entries.capacity() * sizeof(uint32_t);
+    }
+    return bytes;
+}
+} // namespace gbc
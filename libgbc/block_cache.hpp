@@ -0,0 +1,125 @@
+#pragma once
+#include "common.hpp"
+#include "instruction.hpp"
+#include <array>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace gbc
+{
+// an instruction decoded ahead of time
+struct decoded_t
+{
+    handler_t handler;
+    uint16_t pc;
+    uint8_t length;
+    uint8_t cycles;   // base cycles, without branch penalties
+    uint8_t bytes[3]; // opcode and operands
+
+    uint8_t opcode() const noexcept { return bytes[0]; }
+};
+
+// a copy, fill or delay loop, that can run many iterations at once
+struct fused_loop_t
+{
+    enum kind_t : uint8_t
+    {
+        NONE = 0,
+        DELAY, // DEC r; JR NZ or DEC rr; LD A, hi; OR lo; JR NZ
+        COPY,  // LD A, (HL+/-); LD (DE), A; INC DE and a counter
+        FILL,  // LD (HL+/-), A and a counter
+    };
+    kind_t kind = NONE;
+    int8_t step = 0;      // HL increment of COPY and FILL
+    uint8_t counter = 0;  // getdest() index of DEC r, or getreg() index of DEC rr
+    bool wide = false;    // the counter is a register pair
+    uint8_t period = 0;   // cycles per iteration
+};
+
+struct block_t
+{
+    uint32_t key;
+    std::vector<decoded_t> instr;
+    // loops back to itself, only polling memory or I/O for a change
+    bool idle_loop = false;
+    fused_loop_t fused;
+    // JIT bookkeeping: times entered, and the translation once hot
+    uint32_t hits = 0;
+    uint8_t* native = nullptr;
+    std::vector<uint32_t> entries; // native offset of each instruction
+};
+
+class BlockCache
+{
+public:
+    static const int MAX_BLOCK_INSTR = 64;
+    BlockCache(CPU&);
+
+    // get the pre-decoded instruction at @pc, decoding a new block if needed,
+    // or nullptr when the code at @pc is not cacheable
+    const decoded_t* fetch(uint16_t pc);
+    // the next instruction along the current block, if it is at @pc
+    const decoded_t* follow(const uint16_t pc) noexcept
+    {
+        if (m_block == nullptr || m_index >= m_block->instr.size()) return nullptr;
+        const decoded_t& instr = m_block->instr[m_index];
+        if (UNLIKELY(instr.pc != pc)) return nullptr;
+        m_index++;
+        return m_current = &instr;
+    }
+    // the instruction currently executing, if it came from the cache
+    const decoded_t* current() const noexcept { return m_current; }
+    void issue(const decoded_t& instr) noexcept { m_current = &instr; }
+    void retire() noexcept { m_current = nullptr; }
+    // the block of the last fetched instruction, and its index in the block
+    block_t* block() const noexcept { return m_block; }
+    size_t block_index() const noexcept { return m_index - 1; }
+    // stop following the current block
+    void leave() noexcept
+    {
+        m_block = nullptr;
+        m_current = nullptr;
+    }
+    // continue along @block from @pc, eg. after running part of it natively
+    void resume(block_t& block, uint16_t pc) noexcept;
+
+    // ROM or WRAM banks changed: stop following the current block
+    void bank_switched() noexcept { m_block = nullptr; }
+    // writes to RAM invalidate the code cached from that page
+    void ram_written(uint16_t addr)
+    {
+        if (UNLIKELY(!m_page_blocks[addr >> 8].empty())) this->flush_page(addr >> 8);
+    }
+    // true when running @block again cannot change anything but time,
+    // provided the memory it reads doesn't change
+    bool idle_loop_ready(const block_t& block) const;
+    // true when the 256-byte RAM page at @page contains cached code
+    bool code_page(uint8_t page) const noexcept { return !m_page_blocks[page].empty(); }
+    // throw away the blocks with code in the RAM page at @page
+    void flush_page(uint8_t page);
+    void flush_ram();
+    void flush();
+
+    size_t size() const noexcept { return m_blocks.size(); }
+    // approximate bytes allocated for decoded blocks
+    size_t footprint() const noexcept;
+    // incremented whenever every block is thrown away
+    uint32_t generation() const noexcept { return m_generation; }
+
+private:
+    bool cache_key(uint16_t pc, uint32_t& key, uint32_t& end) const;
+    block_t* decode_block(uint32_t key, uint16_t pc, uint32_t end);
+    static size_t lookup_index(uint32_t key) noexcept { return (key * 2654435761u) >> 22; }
+
+    CPU& m_cpu;
+    std::unordered_map<uint32_t, block_t> m_blocks;
+    std::array<block_t*, 1024> m_lookup = {};
+    block_t* m_block = nullptr;
+    size_t m_index = 0;
+    const decoded_t* m_current = nullptr;
+    // the keys of the cached blocks in each 256-byte page of RAM
+    std::array<std::vector<uint32_t>, 256> m_page_blocks;
+    uint32_t m_generation = 0;
+};
+} // namespace gbc
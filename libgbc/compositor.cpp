@@ -0,0 +1,160 @@
+#include "gpu.hpp"
+
+#include <cstring>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Mixing the layers of a scanline into palette indices: the BG with the CGB
+// priority bit set covers everything, and otherwise the sprite pixel covers
+// the BG and window, unless it is behind a BG color other than 0.
+// The vector paths work on 32 or 16 pixels at a time, and 160 is a multiple
+// of both, with the scalar version as the fallback and the reference.
+namespace gbc
+{
+#if defined(__AVX2__) || defined(__SSE2__)
+#if defined(__AVX2__)
+using vec_t = __m256i;
+static inline vec_t v_load(const uint8_t* p) { return _mm256_load_si256((const vec_t*) p); }
+static inline vec_t v_set(uint8_t v) { return _mm256_set1_epi8(v); }
+static inline vec_t v_and(vec_t a, vec_t b) { return _mm256_and_si256(a, b); }
+static inline vec_t v_or(vec_t a, vec_t b) { return _mm256_or_si256(a, b); }
+static inline vec_t v_andnot(vec_t a, vec_t b) { return _mm256_andnot_si256(a, b); }
+static inline vec_t v_add(vec_t a, vec_t b) { return _mm256_add_epi8(a, b); }
+static inline vec_t v_eq(vec_t a, vec_t b) { return _mm256_cmpeq_epi8(a, b); }
+static inline vec_t v_shl2(vec_t a) { return _mm256_slli_epi16(a, 2); }
+static inline vec_t v_select(vec_t mask, vec_t a, vec_t b)
+{
+    return _mm256_blendv_epi8(b, a, mask);
+}
+#else
+using vec_t = __m128i;
+static inline vec_t v_load(const uint8_t* p) { return _mm_load_si128((const vec_t*) p); }
+static inline vec_t v_set(uint8_t v) { return _mm_set1_epi8(v); }
+static inline vec_t v_and(vec_t a, vec_t b) { return _mm_and_si128(a, b); }
+static inline vec_t v_or(vec_t a, vec_t b) { return _mm_or_si128(a, b); }
+static inline vec_t v_andnot(vec_t a, vec_t b) { return _mm_andnot_si128(a, b); }
+static inline vec_t v_add(vec_t a, vec_t b) { return _mm_add_epi8(a, b); }
+static inline vec_t v_eq(vec_t a, vec_t b) { return _mm_cmpeq_epi8(a, b); }
+static inline vec_t v_shl2(vec_t a) { return _mm_slli_epi16(a, 2); }
+static inline vec_t v_select(vec_t mask, vec_t a, vec_t b)
+{
+    return v_or(v_and(mask, a), v_andnot(mask, b));
+}
+#endif
+static constexpr int VEC_PIXELS = sizeof(vec_t);
+
+// 4 * palette + color, for CGB attributes
+static inline vec_t v_cgb_index(vec_t attr, vec_t color)
+{
+    return v_add(v_and(v_shl2(attr), v_set(0x1C)), color);
+}
+// the shade of each color in a DMG palette register
+static inline vec_t v_dmg_index(vec_t color, uint8_t pal)
+{
+    vec_t result = v_and(v_eq(color, v_set(0)), v_set(pal & 0x3));
+    result = v_or(result, v_and(v_eq(color, v_set(1)), v_set((pal >> 2) & 0x3)));
+    result = v_or(result, v_and(v_eq(color, v_set(2)), v_set((pal >> 4) & 0x3)));
+    return v_or(result, v_and(v_eq(color, v_set(3)), v_set(pal >> 6)));
+}
+
+static inline vec_t compose_pixels(const GPU::scanline_t& line, const tileconf_t& tconf,
+                                   const sprite_config_t& sconf, const int x)
+{
+    const vec_t zero = v_set(0);
+    const vec_t bg_color = v_load(&line.bg_colors[x]);
+    const vec_t sprite = v_load(&line.sprite_colors[x]);
+    const vec_t sattr = v_load(&line.sprite_attrs[x]);
+    // sprites behind the BG only show on BG color 0
+    const vec_t behind = v_eq(v_and(sattr, v_set(0x80)), v_set(0x80));
+    const vec_t hidden = v_or(v_eq(sprite, zero), v_andnot(v_eq(bg_color, zero), behind));
+    const vec_t sprite_on = v_andnot(hidden, v_set(0xFF));
+    if (tconf.is_cgb)
+    {
+        const vec_t bg_attr = v_load(&line.bg_attrs[x]);
+        const vec_t tile = v_cgb_index(v_load(&line.attrs[x]), v_load(&line.colors[x]));
+        const vec_t obj = v_add(v_cgb_index(sattr, sprite), v_set(32));
+        const vec_t bg_priority = v_eq(v_and(bg_attr, v_set(0x80)), v_set(0x80));
+        return v_select(bg_priority, v_cgb_index(bg_attr, bg_color),
+                        v_select(sprite_on, obj, tile));
+    }
+    const vec_t tile = v_dmg_index(v_load(&line.colors[x]), tconf.dmg_pal);
+    const vec_t obp1 = v_eq(v_and(sattr, v_set(0x10)), v_set(0x10));
+    const vec_t obj = v_select(obp1, v_dmg_index(sprite, sconf.palette[1]),
+                               v_dmg_index(sprite, sconf.palette[0]));
+    return v_select(sprite_on, obj, tile);
+}
+#endif
+
+static inline uint8_t compose_pixel(const GPU::scanline_t& line, const tileconf_t& tconf,
+                                    const sprite_config_t& sconf, const int x)
+{
+    const uint8_t sprite = line.sprite_colors[x];
+    const uint8_t sattr = line.sprite_attrs[x];
+    const bool sprite_on = sprite != 0 && ((sattr & 0x80) == 0 || line.bg_colors[x] == 0);
+    if (tconf.is_cgb)
+    {
+        if (line.bg_attrs[x] & 0x80) return 4 * (line.bg_attrs[x] & 0x7) + line.bg_colors[x];
+        if (sprite_on) return 32 + 4 * (sattr & 0x7) + sprite;
+        return 4 * (line.attrs[x] & 0x7) + line.colors[x];
+    }
+    if (sprite_on) return (sconf.palette[(sattr >> 4) & 1] >> (sprite * 2)) & 0x3;
+    return (tconf.dmg_pal >> (line.colors[x] * 2)) & 0x3;
+}
+
+void GPU::compose_indices_scalar(const scanline_t& line, const tileconf_t& tconf,
+                                 const sprite_config_t& sconf, uint8_t* indices)
+{
+    for (int x = 0; x < SCREEN_W; x++) indices[x] = compose_pixel(line, tconf, sconf, x);
+}
+
+void GPU::compose_indices(const scanline_t& line, const tileconf_t& tconf,
+                          const sprite_config_t& sconf, uint8_t* indices)
+{
+#if defined(__AVX2__) || defined(__SSE2__)
+    static_assert(SCREEN_W % VEC_PIXELS == 0, "Scanlines must be whole vectors");
+    for (int x = 0; x < SCREEN_W; x += VEC_PIXELS)
+    {
+        const vec_t result = compose_pixels(line, tconf, sconf, x);
+        std::memcpy(&indices[x], &result, sizeof(result));
+    }
+#else
+    compose_indices_scalar(line, tconf, sconf, indices);
+#endif
+}
+
+void GPU::compose_scanline(const scanline_t& line, const tileconf_t& tconf,
+                           const sprite_config_t& sconf, PixelType* pixels) const
+{
+    alignas(32) std::array<uint8_t, SCREEN_W> indices;
+    compose_indices(line, tconf, sconf, indices.data());
+
+#ifdef GAMEBRO_INDEXED_FRAME
+    std::copy(indices.begin(), indices.end(), pixels);
+#else
+    // the 15-bit colors of the palettes as they are right now, with room for
+    // gathering 32 bits from the last one
+    alignas(32) std::array<uint16_t, NUM_PALETTES + 2> palette{};
+    std::memcpy(palette.data(), m_state.cgb_palette.data(), m_state.cgb_palette.size());
+#if defined(__AVX2__)
+    for (int x = 0; x < SCREEN_W; x += 16)
+    {
+        const __m256i mask = _mm256_set1_epi32(0xFFFF);
+        const __m256i lo = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) &indices[x]));
+        const __m256i hi =
+            _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) &indices[x + 8]));
+        const auto* base = (const int*) palette.data();
+        const __m256i c0 = _mm256_and_si256(_mm256_i32gather_epi32(base, lo, 2), mask);
+        const __m256i c1 = _mm256_and_si256(_mm256_i32gather_epi32(base, hi, 2), mask);
+        // packing works within each 128-bit lane, so the middle halves are swapped
+        const __m256i colors = _mm256_permute4x64_epi64(_mm256_packus_epi32(c0, c1), 0xD8);
+        _mm256_storeu_si256((__m256i*) &pixels[x], colors);
+    }
+#else
+    for (int x = 0; x < SCREEN_W; x++) pixels[x] = palette[indices[x]];
+#endif
+#endif
+}
+} // namespace gbc
@@ -6,10 +6,13 @@
 
 namespace gbc
 {
-CPU::CPU(Machine& mach) noexcept : m_machine(mach), m_memory(mach.memory) {}
+const std::array<uint8_t, 2 * 256 * 256> ALU_FLAGS = make_alu_flags();
+
+CPU::CPU(Machine& mach) noexcept : m_machine(mach), m_memory(mach.memory), m_cache(*this) {}
 
 void CPU::reset() noexcept
 {
+    registers().lazy_op = regs_t::FLAGS_RESOLVED;
     if (!machine().is_cgb())
     {
         // gameboy DMG initial register values
@@ -43,9 +46,18 @@ void CPU::simulate()
     // handle interrupts
     this->handle_interrupts();
 
-    if (!this->is_halting() && !this->is_stopping()) { this->execute(); }
+    if (!this->is_halting() && !this->is_stopping())
+    {
+#ifdef GAMEBRO_THREADED_CODE
+        this->execute_threaded();
+#else
+        this->execute();
+#endif
+    }
     else
     {
+        // nothing can wake us up before the next device event
+        if (this->is_halting()) this->skip_halt();
         // make sure time passes when not executing instructions
         this->hardware_tick();
         // speed switch
@@ -55,16 +67,48 @@ void CPU::simulate()
 
 void CPU::execute()
 {
-    // 1. read instruction from memory
-    const uint8_t opcode = this->peekop8(0);
-    // 2. decode into executable instruction
-    auto& instr = decode(opcode);
+    // 1. use the pre-decoded instruction, when cached
+    const decoded_t* cached = m_cache.fetch(registers().pc);
+    // polling loops can only be (re-)entered at the top of a block
+    if (UNLIKELY(cached == nullptr || m_cache.block_index() == 0))
+    {
+        const block_t* block = cached ? m_cache.block() : nullptr;
+        this->skip_idle_loop(block);
+        // the loop may have written over cached code, which erases the block
+        if (block != nullptr && block->fused.kind && this->run_fused_loop(*block))
+            cached = m_cache.fetch(registers().pc);
+    }
+    // run the rest of the block natively instead, when it has been translated
+    if (UNLIKELY(m_jit != nullptr) && cached != nullptr && m_cache.block() != nullptr)
+    {
+        block_t& block = *m_cache.block();
+        if (m_jit->execute(block, m_cache.block_index()))
+        {
+            m_cache.resume(block, registers().pc);
+            this->verify_pc();
+            return;
+        }
+    }
+    uint8_t opcode;
+    handler_t handler;
+    if (LIKELY(cached != nullptr))
+    {
+        opcode = cached->opcode();
+        handler = cached->handler;
+    }
+    else
+    {
+        // 1a. read instruction from memory
+        opcode = this->peekop8(0);
+        // 1b. decode into executable instruction
+        handler = decode(opcode).handler;
+    }
 
-    // 2a. print the instruction (when enabled)
+    // 2. print the instruction (when enabled)
     if (UNLIKELY(machine().verbose_instructions))
     {
         char prn[128];
-        instr.printer(prn, sizeof(prn), *this, opcode);
+        decode(opcode).printer(prn, sizeof(prn), *this, opcode);
         printf("%9lu: [pc %04X] opcode %02X: %s\n", gettime(), registers().pc, opcode, prn);
     }
 
@@ -73,18 +117,25 @@ void CPU::execute()
     this->hardware_tick();
 
     // 4. run instruction handler
-    instr.handler(*this, opcode);
+    handler(*this, opcode);
+    m_cache.retire();
 
     if (UNLIKELY(machine().verbose_instructions))
     {
         // print out the resulting flags reg
-        if (m_state.last_flags != registers().flags)
+        const uint8_t flags = registers().current_flags();
+        if (m_state.last_flags != flags)
         {
-            m_state.last_flags = registers().flags;
+            m_state.last_flags = flags;
             char fbuf[5];
-            printf("* Flags changed: [%s]\n", cstr_flags(fbuf, registers().flags));
+            printf("* Flags changed: [%s]\n", cstr_flags(fbuf, flags));
         }
     }
+    this->verify_pc();
+}
+
+void CPU::verify_pc()
+{
     if (UNLIKELY(memory().is_within(registers().pc, Memory::VideoRAM)))
     {
         fprintf(stderr, "ERROR: PC is in the Video RAM area: %04X\n", registers().pc);
@@ -107,12 +158,147 @@ void CPU::execute()
     }
 }
 
+void CPU::enable_jit(const bool enabled)
+{
+    if (enabled && m_jit == nullptr && JIT::is_supported())
+        m_jit.reset(new JIT(*this));
+    else if (!enabled)
+        m_jit = nullptr;
+}
+
+void CPU::skip_halt()
+{
+    // EI/DI countdowns and debugging happen once per simulate() call
+    if (m_state.intr_pending != 0 || m_state.stopped) return;
+    if (m_break || m_break_steps_cnt != 0 || !m_breakpoints.empty()) return;
+    const uint64_t next = machine().scheduler.next_event();
+    const uint64_t now = gettime();
+    if (next == Scheduler::NEVER || next <= now + 4) return;
+    // stop one tick short, so that the next tick runs the event
+    const uint64_t ticks = (next - now + 3) / 4;
+    this->m_state.cycles_total = now + (ticks - 1) * 4;
+}
+
+void CPU::skip_idle_loop(const block_t* block)
+{
+    auto& scheduler = machine().scheduler;
+    if (block == nullptr || !block->idle_loop)
+    {
+        m_idle.block = nullptr;
+        return;
+    }
+    // back at the top after one iteration where no event happened: the next
+    // iterations read the same values and do the same, until the next event
+    if (m_idle.block == block && m_idle.generation == m_cache.generation() &&
+        m_idle.dispatches == scheduler.dispatches() && m_state.intr_pending == 0 && !m_break &&
+        m_break_steps_cnt == 0 && m_breakpoints.empty() && !machine().verbose_instructions &&
+        !machine().break_on_io && !memory().has_watchpoints() && m_cache.idle_loop_ready(*block))
+    {
+        const uint64_t period = gettime() - m_idle.time;
+        const uint64_t next = scheduler.next_event();
+        if (period > 0 && next != Scheduler::NEVER && next > gettime())
+        {
+            // every skipped iteration must end before the event
+            const uint64_t iterations = (next - 1 - gettime()) / period;
+            this->m_state.cycles_total += iterations * period;
+        }
+    }
+    m_idle.block = block;
+    m_idle.time = gettime();
+    m_idle.dispatches = scheduler.dispatches();
+    m_idle.generation = m_cache.generation();
+}
+
+// plain memory, that reads and writes the same regardless of time
+static bool bulk_accessible(const uint16_t addr, const bool write) noexcept
+{
+    if (addr < 0x8000) return !write; // writes go to the MBC
+    if (addr >= 0xA000 && addr < 0xC000) return false;
+    if (addr >= 0xFEA0) return Memory::is_within(addr, Memory::ZRAM);
+    return true;
+}
+
+bool CPU::run_fused_loop(const block_t& block)
+{
+    // a copy, as writing over cached RAM code erases the block
+    const fused_loop_t loop = block.fused;
+    // EI/DI countdowns and debugging happen once per simulate() call
+    if (m_state.intr_pending != 0 || m_break || m_break_steps_cnt != 0 ||
+        !m_breakpoints.empty() || machine().verbose_instructions)
+        return false;
+    if (memory().has_read_breakpoints() || memory().has_write_breakpoints() ||
+        memory().has_watchpoints())
+        return false;
+
+    auto& regs = registers();
+    uint32_t count = loop.wide ? regs.getreg(loop.counter, false) : regs.getdest(loop.counter);
+    if (count == 0) count = loop.wide ? 0x10000 : 0x100;
+    // the last iteration leaves the loop, and is interpreted as usual
+    uint64_t iterations = count - 1;
+    // every iteration must end before the next event
+    const uint64_t next = machine().scheduler.next_event();
+    if (next != Scheduler::NEVER)
+    {
+        if (next <= gettime()) return false;
+        iterations = std::min(iterations, (next - 1 - gettime()) / loop.period);
+    }
+    uint64_t done = 0;
+    // stop after an iteration that wrote over cached code, as that code may
+    // be the loop itself (see BlockCache::ram_written)
+    if (loop.kind == fused_loop_t::COPY)
+    {
+        for (; done < iterations && m_cache.block() != nullptr; done++)
+        {
+            if (!bulk_accessible(regs.hl, false) || !bulk_accessible(regs.de, true)) break;
+            regs.accum = memory().read8(regs.hl);
+            memory().write8(regs.de, regs.accum);
+            regs.hl += loop.step;
+            regs.de++;
+        }
+    }
+    else if (loop.kind == fused_loop_t::FILL)
+    {
+        for (; done < iterations && m_cache.block() != nullptr; done++)
+        {
+            if (!bulk_accessible(regs.hl, true)) break;
+            memory().write8(regs.hl, regs.accum);
+            regs.hl += loop.step;
+        }
+    }
+    else
+    {
+        done = iterations;
+    }
+    if (done == 0) return false;
+
+    // registers and flags as left by the last fused iteration
+    regs.resolve_flags();
+    if (loop.wide)
+    {
+        auto& counter = regs.getreg(loop.counter, false);
+        counter -= done;
+        // LD A, hi; OR lo
+        regs.accum = (counter >> 8) | (counter & 0xFF);
+        regs.flags = 0;
+    }
+    else
+    {
+        auto& counter = regs.getdest(loop.counter);
+        counter -= done;
+        // DEC r
+        regs.flags = (regs.flags & ~(MASK_ZERO | MASK_HALFCARRY)) | MASK_NEGATIVE;
+        setflag((counter & 0xF) == 0xF, regs.flags, MASK_HALFCARRY);
+    }
+    this->m_state.cycles_total += done * loop.period;
+    return true;
+}
+
 void CPU::hardware_tick()
 {
     this->incr_cycles(4);
-    machine().gpu.simulate();
-    machine().io.simulate();
-    machine().apu.simulate();
+    // devices only need attention when one of their events is due
+    auto& scheduler = machine().scheduler;
+    if (UNLIKELY(scheduler.is_due(gettime()))) scheduler.run_events(gettime());
 }
 
 // it takes 2 instruction-cycles to toggle interrupts
@@ -183,18 +369,58 @@ void CPU::interrupt(interrupt_t& intr)
     if (intr.callback) intr.callback(machine(), intr);
 }
 
-instruction_t& CPU::decode(const uint8_t opcode)
+// every instruction handler, see instructions.cpp
+enum class family_t
+{
+    NOP,
+    LD_N_SP,
+    STOP,
+    HALT,
+    LD_D_N,
+    LD_D_D,
+    LD_R_A_R,
+    LD_N_A_N,
+    LDID_HL_A,
+    LD_FF00_A,
+    LD_R_N,
+    ADD_SP_N,
+    LD_HL_SP,
+    PUSH_POP,
+    ALU_A_D,
+    ALU_A_N,
+    INC_DEC_R,
+    INC_DEC_D,
+    ADD_HL_R,
+    DAA,
+    CPL_A,
+    SCF_CCF,
+    RLC_RRC,
+    JP,
+    JP_HL,
+    JR_N,
+    CALL,
+    RET,
+    RETI,
+    RST,
+    DI_EI,
+    CB_EXT,
+    MISSING,
+};
+
+// the instruction family that implements each opcode, used to build the
+// table of handlers specialized on their opcode
+static constexpr family_t opcode_family(const uint8_t opcode)
 {
     switch (opcode)
     {
     case 0x00: // NOP
-        return instr_NOP;
+        return family_t::NOP;
     case 0x08: // LD SP, imm16
-        return instr_LD_N_SP;
+        return family_t::LD_N_SP;
     case 0x10: // STOP
-        return instr_STOP;
+        return family_t::STOP;
     case 0x76: // HALT
-        return instr_HALT;
+        return family_t::HALT;
     // LD D, imm8
     case 0x06:
     case 0x16:
@@ -204,7 +430,7 @@ instruction_t& CPU::decode(const uint8_t opcode)
     case 0x1E:
     case 0x2E:
     case 0x3E:
-        return instr_LD_D_N;
+        return family_t::LD_D_N;
     // LD B, D
     case 0x40:
     case 0x41:
@@ -277,37 +503,37 @@ instruction_t& CPU::decode(const uint8_t opcode)
     case 0x7D:
     case 0x7E:
     case 0x7F:
-        return instr_LD_D_D;
+        return family_t::LD_D_D;
     // LD A, R
     case 0x02:
     case 0x12:
     case 0x0A:
     case 0x1A:
-        return instr_LD_R_A_R;
+        return family_t::LD_R_A_R;
     case 0xEA: // LD (imm16), A
     case 0xFA: // LD A, (imm16)
-        return instr_LD_N_A_N;
+        return family_t::LD_N_A_N;
     case 0x22: // LDI (HL), A
     case 0x32: // LDD (HL), A
     case 0x2A: // LDI A, (HL)
     case 0x3A: // LDD A, (HL)
-        return instr_LDID_HL_A;
+        return family_t::LDID_HL_A;
     case 0xE2: // LD (FF00+C), A
     case 0xF2: // LD A, (FF00+C)
     case 0xE0: // LD (FF00+imm8), A
     case 0xF0: // LD A, (FF00+imm8)
-        return instr_LD_FF00_A;
+        return family_t::LD_FF00_A;
     // LD R, imm16
     case 0x01:
     case 0x11:
     case 0x21:
     case 0x31:
-        return instr_LD_R_N;
+        return family_t::LD_R_N;
     case 0xE8:
-        return instr_ADD_SP_N;
+        return family_t::ADD_SP_N;
     case 0xF8: // LD HL, SP+imm8
     case 0xF9: // LD SP, HL
-        return instr_LD_HL_SP;
+        return family_t::LD_HL_SP;
     // POP R
     case 0xC1:
     case 0xD1:
@@ -318,7 +544,7 @@ instruction_t& CPU::decode(const uint8_t opcode)
     case 0xD5:
     case 0xE5:
     case 0xF5:
-        return instr_PUSH_POP;
+        return family_t::PUSH_POP;
     // ALU operations
     // ADD A, D
     case 0x80:
@@ -329,7 +555,7 @@ instruction_t& CPU::decode(const uint8_t opcode)
     case 0x85:
     case 0x86:
     case 0x87:
-        return instr_ALU_A_D;
+        return family_t::ALU_A_D;
     // ADC A, D
     case 0x88:
     case 0x89:
@@ -339,7 +565,7 @@ instruction_t& CPU::decode(const uint8_t opcode)
     case 0x8D:
     case 0x8E:
     case 0x8F:
-        return instr_ALU_A_D;
+        return family_t::ALU_A_D;
     // SUB A, D
     case 0x90:
     case 0x91:
@@ -349,7 +575,7 @@ instruction_t& CPU::decode(const uint8_t opcode)
     case 0x95:
     case 0x96:
     case 0x97:
-        return instr_ALU_A_D;
+        return family_t::ALU_A_D;
     // SBC A, D
     case 0x98:
     case 0x99:
@@ -359,7 +585,7 @@ instruction_t& CPU::decode(const uint8_t opcode)
     case 0x9D:
     case 0x9E:
     case 0x9F:
-        return instr_ALU_A_D;
+        return family_t::ALU_A_D;
     // AND A, D
     case 0xA0:
     case 0xA1:
@@ -369,7 +595,7 @@ instruction_t& CPU::decode(const uint8_t opcode)
     case 0xA5:
     case 0xA6:
     case 0xA7:
-        return instr_ALU_A_D;
+        return family_t::ALU_A_D;
     // XOR A, D
     case 0xA8:
     case 0xA9:
@@ -379,7 +605,7 @@ instruction_t& CPU::decode(const uint8_t opcode)
     case 0xAD:
     case 0xAE:
     case 0xAF:
-        return instr_ALU_A_D;
+        return family_t::ALU_A_D;
     // OR  A, D
     case 0xB0:
     case 0xB1:
@@ -389,7 +615,7 @@ instruction_t& CPU::decode(const uint8_t opcode)
     case 0xB5:
     case 0xB6:
     case 0xB7:
-        return instr_ALU_A_D;
+        return family_t::ALU_A_D;
     // CP A, D
     case 0xB8:
     case 0xB9:
@@ -399,7 +625,7 @@ instruction_t& CPU::decode(const uint8_t opcode)
     case 0xBD:
     case 0xBE:
     case 0xBF:
-        return instr_ALU_A_D;
+        return family_t::ALU_A_D;
     // ALU OP A, im8
     case 0xC6:
     case 0xCE:
@@ -409,7 +635,7 @@ instruction_t& CPU::decode(const uint8_t opcode)
     case 0xEE:
     case 0xF6:
     case 0xFE:
-        return instr_ALU_A_N;
+        return family_t::ALU_A_N;
     // INC R, DEC R
     case 0x03:
     case 0x0B:
@@ -419,7 +645,7 @@ instruction_t& CPU::decode(const uint8_t opcode)
     case 0x2B:
     case 0x33:
     case 0x3B:
-        return instr_INC_DEC_R;
+        return family_t::INC_DEC_R;
     // INC D, DEC D
     case 0x04:
     case 0x05:
@@ -437,53 +663,53 @@ instruction_t& CPU::decode(const uint8_t opcode)
     case 0x35:
     case 0x3C:
     case 0x3D:
-        return instr_INC_DEC_D;
+        return family_t::INC_DEC_D;
     // ADD HL, R
     case 0x09:
     case 0x19:
     case 0x29:
     case 0x39:
-        return instr_ADD_HL_R;
+        return family_t::ADD_HL_R;
     case 0x27: // DA A
-        return instr_DAA;
+        return family_t::DAA;
     case 0x2F: // CPL A
-        return instr_CPL_A;
+        return family_t::CPL_A;
     case 0x37: // SCF
     case 0x3F: // CCF
-        return instr_SCF_CCF;
+        return family_t::SCF_CCF;
     case 0x07: // RLC A
     case 0x17: // RL A
     case 0x0F: // RRC A
     case 0x1F: // RR A
-        return instr_RLC_RRC;
+        return family_t::RLC_RRC;
     case 0xC3: // JP imm16
     case 0xC2: // JP nz, imm16
     case 0xCA: // JP z, imm16
     case 0xD2: // JP nc, imm16
     case 0xDA: // JP c, imm16
-        return instr_JP;
+        return family_t::JP;
     case 0xE9: // JP HL
-        return instr_JP_HL;
+        return family_t::JP_HL;
     case 0x18: // JR imm8
     case 0x20: // JR nz, imm8
     case 0x28: // JR z, imm8
     case 0x30: // JR nc, imm8
     case 0x38: // JR c, imm8
-        return instr_JR_N;
+        return family_t::JR_N;
     case 0xCD: // CALL imm16
     case 0xC4: // CALL nz, imm16
     case 0xCC: // CALL z, imm16
     case 0xD4: // CALL nc, imm16
     case 0xDC: // CALL c, imm16
-        return instr_CALL;
+        return family_t::CALL;
     case 0xC9: // RET
     case 0xC0: // RET nz
     case 0xC8: // RET z
     case 0xD0: // RET nc
     case 0xD8: // RET c
-        return instr_RET;
+        return family_t::RET;
     case 0xD9: // RETI
-        return instr_RETI;
+        return family_t::RETI;
     // RST 0x0, 0x08, 0x10, 0x18
     case 0xC7:
     case 0xCF:
@@ -494,28 +720,190 @@ instruction_t& CPU::decode(const uint8_t opcode)
     case 0xEF:
     case 0xF7:
     case 0xFF:
-        return instr_RST;
+        return family_t::RST;
     case 0xF3: // DI
     case 0xFB: // EI
-        return instr_DI_EI;
+        return family_t::DI_EI;
     case 0xCB:
-        return instr_CB_EXT;
+        return family_t::CB_EXT;
+    }
+    return family_t::MISSING;
+}
+
+#define DECODE(x)                                                                                  \
+    if constexpr (opcode_family(opcode) == family_t::x) return instr_##x<opcode>;                 \
+    else
+template <uint8_t opcode> static constexpr instruction_t decode_opcode()
+{
+    DECODE(NOP)
+    DECODE(LD_N_SP)
+    DECODE(STOP)
+    DECODE(HALT)
+    DECODE(LD_D_N)
+    DECODE(LD_D_D)
+    DECODE(LD_R_A_R)
+    DECODE(LD_N_A_N)
+    DECODE(LDID_HL_A)
+    DECODE(LD_FF00_A)
+    DECODE(LD_R_N)
+    DECODE(ADD_SP_N)
+    DECODE(LD_HL_SP)
+    DECODE(PUSH_POP)
+    DECODE(ALU_A_D)
+    DECODE(ALU_A_N)
+    DECODE(INC_DEC_R)
+    DECODE(INC_DEC_D)
+    DECODE(ADD_HL_R)
+    DECODE(DAA)
+    DECODE(CPL_A)
+    DECODE(SCF_CCF)
+    DECODE(RLC_RRC)
+    DECODE(JP)
+    DECODE(JP_HL)
+    DECODE(JR_N)
+    DECODE(CALL)
+    DECODE(RET)
+    DECODE(RETI)
+    DECODE(RST)
+    DECODE(DI_EI)
+    DECODE(CB_EXT)
+    return instr_MISSING<opcode>;
+}
+#undef DECODE
+
+template <size_t... OP>
+static constexpr std::array<instruction_t, 256> make_opcode_table(std::index_sequence<OP...>)
+{
+    return {decode_opcode<OP>()...};
+}
+static constexpr auto OPCODE_TABLE = make_opcode_table(std::make_index_sequence<256>{});
+
+const instruction_t& CPU::decode(const uint8_t opcode) { return OPCODE_TABLE[opcode]; }
+handler_t CPU::decode_cb(const uint8_t cb_opcode) { return CB_HANDLERS[cb_opcode]; }
+
+#ifdef GAMEBRO_THREADED_CODE
+#ifndef __GNUC__
+#error "The threaded interpreter needs labels as values (GCC or Clang)"
+#endif
+// Threaded interpreter: each opcode has its own inlined handler followed by
+// its own copy of the dispatch code, so there is one indirect jump per
+// instruction instead of a call through instruction_t::handler. It keeps
+// going until something happens that CPU::simulate() has to look at.
+void CPU::execute_threaded()
+{
+    if (UNLIKELY(m_jit != nullptr || machine().verbose_instructions || m_break ||
+                 m_break_steps_cnt != 0 || !m_breakpoints.empty()))
+    {
+        this->execute();
+        return;
     }
-    return instr_MISSING;
+#define THREAD_LABEL(op) &&op_##op,
+#define THREAD_LABELS(x)                                                                           \
+    THREAD_LABEL(x##0) THREAD_LABEL(x##1) THREAD_LABEL(x##2) THREAD_LABEL(x##3)                    \
+    THREAD_LABEL(x##4) THREAD_LABEL(x##5) THREAD_LABEL(x##6) THREAD_LABEL(x##7)                    \
+    THREAD_LABEL(x##8) THREAD_LABEL(x##9) THREAD_LABEL(x##A) THREAD_LABEL(x##B)                    \
+    THREAD_LABEL(x##C) THREAD_LABEL(x##D) THREAD_LABEL(x##E) THREAD_LABEL(x##F)
+    static void* const dispatch_table[256] = {
+    THREAD_LABELS(0x0)
+    THREAD_LABELS(0x1)
+    THREAD_LABELS(0x2)
+    THREAD_LABELS(0x3)
+    THREAD_LABELS(0x4)
+    THREAD_LABELS(0x5)
+    THREAD_LABELS(0x6)
+    THREAD_LABELS(0x7)
+    THREAD_LABELS(0x8)
+    THREAD_LABELS(0x9)
+    THREAD_LABELS(0xA)
+    THREAD_LABELS(0xB)
+    THREAD_LABELS(0xC)
+    THREAD_LABELS(0xD)
+    THREAD_LABELS(0xE)
+    THREAD_LABELS(0xF)
+    };
+    auto& scheduler = machine().scheduler;
+    const uint64_t dispatches = scheduler.dispatches();
+    const decoded_t* cached;
+    uint8_t opcode;
+// fetch, tick and jump to the next instruction
+#define DISPATCH()                                                                                 \
+    cached = LIKELY(!memory().has_read_breakpoints()) ? m_cache.follow(registers().pc) : nullptr; \
+    if (cached == nullptr) cached = m_cache.fetch(registers().pc);                                 \
+    if (UNLIKELY(cached == nullptr || m_cache.block_index() == 0))                                 \
+    {                                                                                              \
+        this->skip_idle_loop(cached ? m_cache.block() : nullptr);                                  \
+        if (cached != nullptr && m_cache.block()->fused.kind &&                                    \
+            this->run_fused_loop(*m_cache.block()))                                                \
+        { cached = m_cache.fetch(registers().pc); }                                                \
+    }                                                                                              \
+    opcode = LIKELY(cached != nullptr) ? cached->opcode() : this->peekop8(0);                      \
+    registers().pc++;                                                                              \
+    this->hardware_tick();                                                                         \
+    goto* dispatch_table[opcode];
+// the same conditions the JIT leaves translated code on
+#define THREAD(op)                                                                                 \
+    op_##op :                                                                                      \
+    {                                                                                              \
+        constexpr handler_t handler = OPCODE_TABLE[op].handler;                                    \
+        handler(*this, op);                                                                        \
+    }                                                                                              \
+    m_cache.retire();                                                                              \
+    this->verify_pc();                                                                             \
+    if (UNLIKELY(scheduler.dispatches() != dispatches || m_state.intr_pending != 0 ||             \
+                 (this->ime() && machine().io.interrupt_mask() != 0) || this->is_halting() ||      \
+                 this->is_stopping() || m_break || !machine().is_running()))                       \
+    { return; }                                                                                    \
+    DISPATCH()
+#define THREAD16(x)                                                                                \
+    THREAD(x##0) THREAD(x##1) THREAD(x##2) THREAD(x##3) THREAD(x##4) THREAD(x##5) THREAD(x##6)     \
+    THREAD(x##7) THREAD(x##8) THREAD(x##9) THREAD(x##A) THREAD(x##B) THREAD(x##C) THREAD(x##D)     \
+    THREAD(x##E) THREAD(x##F)
+
+    DISPATCH()
+    THREAD16(0x0)
+    THREAD16(0x1)
+    THREAD16(0x2)
+    THREAD16(0x3)
+    THREAD16(0x4)
+    THREAD16(0x5)
+    THREAD16(0x6)
+    THREAD16(0x7)
+    THREAD16(0x8)
+    THREAD16(0x9)
+    THREAD16(0xA)
+    THREAD16(0xB)
+    THREAD16(0xC)
+    THREAD16(0xD)
+    THREAD16(0xE)
+    THREAD16(0xF)
+#undef THREAD16
+#undef THREAD
+#undef DISPATCH
+#undef THREAD_LABELS
+#undef THREAD_LABEL
 }
+#endif
 
 uint8_t CPU::peekop8(int disp) { return memory().read8(registers().pc + disp); }
 uint16_t CPU::peekop16(int disp) { return memory().read16(registers().pc + disp); }
 uint8_t CPU::readop8()
 {
-    const uint8_t operand = peekop8(0);
+    // operands of cached instructions were read when decoding
+    const decoded_t* cached = m_cache.current();
+    const uint16_t idx = registers().pc - (cached ? cached->pc : 0);
+    const uint8_t operand =
+        (cached && idx < cached->length) ? cached->bytes[idx] : peekop8(0);
     registers().pc++;
     hardware_tick();
     return operand;
 }
 uint16_t CPU::readop16()
 {
-    const uint16_t operand = peekop16(0);
+    const decoded_t* cached = m_cache.current();
+    const uint16_t idx = registers().pc - (cached ? cached->pc : 0);
+    const uint16_t operand = (cached && idx + 1 < cached->length)
+                                 ? cached->bytes[idx] | (cached->bytes[idx + 1] << 8)
+                                 : peekop16(0);
     registers().pc += 2;
     hardware_tick();
     hardware_tick();
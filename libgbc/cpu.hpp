@@ -1,12 +1,15 @@
 #pragma once
+#include "block_cache.hpp"
 #include "instruction.hpp"
 #include "interrupt.hpp"
+#include "jit.hpp"
 #include "registers.hpp"
 #include "tracing.hpp"
 #include <array>
 #include <cassert>
 #include <cstdint>
 #include <map>
+#include <memory>
 
 namespace gbc
 {
@@ -22,6 +25,10 @@ public:
     uint64_t gettime() const noexcept { return m_state.cycles_total; }
 
     void execute();
+#ifdef GAMEBRO_THREADED_CODE
+    // run instructions until the next event dispatch or interrupt
+    void execute_threaded();
+#endif
     // read and increment PC, and cycle counters, then tick hardware
     uint8_t readop8();
     uint16_t readop16();
@@ -42,7 +49,9 @@ public:
     void stop();
     void wait(); // wait for interrupts
     void buggy_halt();
-    instruction_t& decode(uint8_t opcode);
+    const instruction_t& decode(uint8_t opcode);
+    // handler for a whole CB-prefixed instruction with second byte @cb_opcode
+    handler_t decode_cb(uint8_t cb_opcode);
 
     regs_t& registers() noexcept { return m_state.registers; }
     // helpers for reading and writing (HL)
@@ -50,7 +59,13 @@ public:
     void write_hl(uint8_t);
 
     Memory& memory() noexcept { return m_memory; }
+    const Memory& memory() const noexcept { return m_memory; }
     Machine& machine() noexcept { return m_machine; }
+    BlockCache& block_cache() noexcept { return m_cache; }
+    const BlockCache& block_cache() const noexcept { return m_cache; }
+    // translate hot ROM blocks to native code, when supported
+    void enable_jit(bool enabled);
+    JIT* jit() const noexcept { return m_jit.get(); }
 
     void enable_interrupts() noexcept;
     void disable_interrupts() noexcept;
@@ -78,12 +93,22 @@ public:
 private:
     void handle_interrupts();
     void handle_speed_switch();
+    // advance time to just before the next event while halted
+    void skip_halt();
+    // advance time over iterations of a polling loop that can't see a change
+    void skip_idle_loop(const block_t*);
+    // run all but the last iteration of a copy, fill or delay loop at once
+    // returns true when iterations ran, after which the block must be fetched again
+    bool run_fused_loop(const block_t&);
     void execute_interrupts(const uint8_t);
     bool break_time() const;
     void interrupt(interrupt_t&);
+    void verify_pc();
 
     Machine& m_machine;
     Memory& m_memory;
+    BlockCache m_cache;
+    std::unique_ptr<JIT> m_jit = nullptr;
     struct state_t
     {
         regs_t registers;
@@ -101,6 +126,15 @@ private:
     mutable int16_t m_break_steps = 0;
     mutable int16_t m_break_steps_cnt = 0;
     std::map<uint16_t, breakpoint_t> m_breakpoints;
+    // the last arrival at the top of an idle loop
+    struct idle_t
+    {
+        const block_t* block = nullptr;
+        uint64_t time = 0;
+        uint64_t dispatches = 0;
+        uint32_t generation = 0;
+    } m_idle;
+    friend class JIT;
 };
 
 inline void CPU::breakpoint(uint16_t addr, breakpoint_t func) { this->m_breakpoints[addr] = func; }
@@ -34,8 +34,8 @@ static void print_help()
       s, step [steps=1]     Run [steps] instructions, then break
       v, verbose            Toggle verbose instruction execution
       b, break [addr]       Breakpoint on executing [addr]
-      rb [addr]             Breakpoint on reading from [addr]
-      wb [addr]             Breakpoint on writing to [addr]
+      rb [addr] (value)     Breakpoint on reading (value) from [addr]
+      wb [addr] (value)     Breakpoint on writing (value) to [addr]
       clear                 Clear all breakpoints
       reset                 Reset the machine
       read [addr] (len=1)   Read from [addr] (len) bytes and print
@@ -97,6 +97,7 @@ static bool execute_commands(CPU& cpu)
     else if (cmd == "clear")
     {
         cpu.breakpoints().clear();
+        cpu.memory().clear_watchpoints();
         return true;
     }
     else if (cmd == "rb" || cmd == "wb")
@@ -108,15 +109,19 @@ static bool execute_commands(CPU& cpu)
             return true;
         }
         uint16_t traploc = std::strtoul(params[1].c_str(), 0, 16) & 0xFFFF;
+        int cond = -1;
+        if (params.size() > 2) cond = std::strtoul(params[2].c_str(), 0, 16) & 0xFF;
         printf("Breaking after any %s %04X (%s)\n", (mode) ? "write to" : "read from", traploc,
                cpu.memory().explain(traploc).c_str());
-        cpu.memory().breakpoint(mode, [traploc, mode](Memory& mem, uint16_t addr, uint8_t value) {
-            if (addr == traploc)
-            {
+        if (cond >= 0) printf("... with value %02X\n", cond);
+        cpu.memory().watchpoint(
+            mode,
+            traploc,
+            [mode](Memory& mem, uint16_t addr, uint8_t value) {
                 if (mode == Memory::READ)
                 {
                     printf("Breaking after read from %04X (%s) with value %02X\n", addr,
-                           mem.explain(addr).c_str(), mem.read8(addr));
+                           mem.explain(addr).c_str(), value);
                 }
                 else
                 { // WRITE
@@ -124,8 +129,8 @@ static bool execute_commands(CPU& cpu)
                            mem.explain(addr).c_str(), value, mem.read8(addr));
                 }
                 mem.machine().break_now();
-            }
-        });
+            },
+            cond);
         return true;
     }
     // verbose instructions
@@ -195,7 +200,7 @@ static bool execute_commands(CPU& cpu)
     // read from VRAM bank 1
     else if (cmd == "readv0" || cmd == "readv1")
     {
-        const uint16_t off = (cmd == "readv0") ? 0x0 : 0x2000;
+        const int bank = (cmd == "readv0") ? 0 : 1;
         if (params.size() < 2)
         {
             printf(">>> Not enough parameters: readv1 [addr]\n");
@@ -203,7 +208,7 @@ static bool execute_commands(CPU& cpu)
         }
         unsigned long hex = std::strtoul(params[1].c_str(), 0, 16);
         hex &= 0x1FFF;
-        printf("VRAM1:%04lX -> %02X\n", hex, cpu.memory().video_ram_ptr()[off + hex]);
+        printf("VRAM%d:%04lX -> %02X\n", bank, hex, cpu.memory().video_bank_ptr(bank)[hex]);
         return true;
     }
     else if (cmd == "vblank" || cmd == "vbl")
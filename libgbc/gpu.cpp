@@ -3,11 +3,15 @@
 #include "machine.hpp"
 #include "sprite.hpp"
 #include "tiledata.hpp"
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <unistd.h>
 
 namespace gbc
 {
+const int GPU::SCREEN_W;
+const int GPU::SCREEN_H;
 const int GPU::WHITE_IDX;
 GPU::GPU(Machine& mach) noexcept
     : m_memory(mach.memory)
@@ -15,6 +19,7 @@ GPU::GPU(Machine& mach) noexcept
     , m_reg_lcdc{io().reg(IO::REG_LCDC)}
     , m_reg_stat{io().reg(IO::REG_STAT)}
     , m_reg_ly{io().reg(IO::REG_LY)}
+    , m_tile_cache{mach.memory}
 {
     this->reset();
 }
@@ -23,6 +28,7 @@ void GPU::reset() noexcept
 {
     m_pixels.resize(SCREEN_W * SCREEN_H);
     this->m_state.video_offset = 0;
+    this->m_state.last_sync = machine().now();
     // set_mode((m_reg_ly >= 144) ? 1 : 2);
 }
 uint64_t GPU::scanline_cycles() const noexcept
@@ -48,7 +54,40 @@ void GPU::simulate()
 {
     // nothing to do with LCD being off
     if (!this->lcd_enabled()) { return; }
-
+    // skip ahead to the tick where this event happens
+    const uint64_t now = machine().now();
+    this->m_state.period += now - m_state.last_sync - 4;
+    this->m_state.last_sync = now;
+    this->tick();
+    this->reschedule();
+}
+void GPU::sync()
+{
+    const uint64_t now = machine().now();
+    if (this->lcd_enabled()) { this->m_state.period += now - m_state.last_sync; }
+    this->m_state.last_sync = now;
+    this->reschedule();
+}
+void GPU::reschedule()
+{
+    auto& scheduler = machine().scheduler;
+    if (!this->lcd_enabled())
+    {
+        scheduler.cancel(Scheduler::GPU_EVENT);
+        return;
+    }
+    // find the next period that changes the mode or scanline
+    uint64_t threshold = scanline_cycles();
+    if (get_mode() == 2)
+        threshold = oam_cycles();
+    else if (get_mode() == 3)
+        threshold = oam_cycles() + vram_cycles();
+    const uint64_t period = m_state.period;
+    const uint64_t ticks = (threshold > period) ? (threshold - period + 3) / 4 : 1;
+    scheduler.schedule(Scheduler::GPU_EVENT, m_state.last_sync + 4 * ticks);
+}
+void GPU::tick()
+{
     auto& vblank = io().vblank;
     auto& lcd_stat = io().lcd_stat;
 
@@ -126,6 +165,9 @@ void GPU::simulate()
             // enable MODE 0: H-blank
             if (m_reg_stat & 0x8) io().trigger(lcd_stat);
             set_mode(0);
+            // H-blank DMA transfers happen at the start of H-blank
+            if (io().hdma_active())
+            { machine().scheduler.schedule(Scheduler::HDMA_EVENT, machine().now()); }
         }
         // printf("Current mode: %u -> %u period %lu\n",
         //        current_mode(), m_reg_stat & 0x3, period);
@@ -137,8 +179,11 @@ bool GPU::is_hblank() const noexcept { return get_mode() == 0; }
 uint8_t GPU::get_mode() const noexcept { return m_reg_stat & 0x3; }
 void GPU::set_mode(uint8_t mode)
 {
+    const bool was_locked = get_mode() == 3;
     this->m_reg_stat &= 0xfc;
     this->m_reg_stat |= mode & 0x3;
+    // the CPU can't access Video RAM in mode 3
+    if (was_locked != (get_mode() == 3)) memory().remap(Memory::VideoRAM);
 }
 
 void GPU::do_ly_comparison()
@@ -168,68 +213,81 @@ void GPU::render_scanline(int scan_y)
 {
     const uint8_t scroll_y = memory().read8(IO::REG_SCY);
     const uint8_t scroll_x = memory().read8(IO::REG_SCX);
-    const int sy = (scan_y + scroll_y) % 256;
 
-    // create tiledata object from LCDC register
+    scanline_t line;
     auto td = this->create_tiledata(bg_tiles(), tile_data());
-    // window visibility
-    const bool window = this->window_visible() && scan_y >= window_y();
-    auto wtd = this->create_tiledata(window_tiles(), tile_data());
+    this->render_tiles(td, scroll_x, scan_y + scroll_y, 0, line.bg_colors.data(),
+                       line.bg_attrs.data());
+    // the window covers the background from WX-7 to the end of the line
+    line.colors = line.bg_colors;
+    line.attrs = line.bg_attrs;
+    if (this->window_visible() && scan_y >= window_y())
+    {
+        auto wtd = this->create_tiledata(window_tiles(), tile_data());
+        this->render_tiles(wtd, 7 - window_x(), scan_y - window_y(), std::max(0, window_x() - 7),
+                           line.colors.data(), line.attrs.data());
+    }
 
     // create sprite configuration structure
     auto sprconf = this->sprite_config();
     sprconf.scan_y = scan_y;
-    // create list of sprites that are on this scanline
-    auto sprites = this->find_sprites(sprconf);
+    this->render_sprites(sprconf, line);
 
-    // tile configuration
-    tileconf_t tileconf = this->tile_config();
+    this->compose_scanline(line, this->tile_config(), sprconf, &m_pixels[scan_y * SCREEN_W]);
+} // render_to(...)
 
-    // render whole scanline
-    for (int scan_x = 0; scan_x < SCREEN_W; scan_x++)
+void GPU::render_sprites(const sprite_config_t& config, scanline_t& line)
+{
+    if (this->m_bucket_height != config.height) this->bucket_sprites(config.height);
+    const auto& bucket = m_sprite_buckets[config.scan_y];
+    // highest priority first: CGB goes by OAM order, while on DMG the
+    // leftmost sprite wins, and then OAM order
+    std::array<const Sprite*, 10> order;
+    const auto end = order.begin() + bucket.count;
+    for (int i = 0; i < bucket.count; i++) order[i] = &sprites_begin()[bucket.sprites[i]];
+    if (!config.is_cgb)
     {
-        const int sx = (scan_x + scroll_x) % 256;
-        // get the tile id and attribute
-        const int tid = td.tile_id(sx / 8, sy / 8);
-        const int tattr = td.tile_attr(sx / 8, sy / 8);
-        // copy the 16-byte tile into buffer
-        const int tile_color = td.pattern(tid, tattr, sx & 7, sy & 7);
-        uint16_t color15 = this->colorize_tile(tileconf, tattr, tile_color);
+        std::stable_sort(order.begin(), end, [](const Sprite* a, const Sprite* b) {
+            return a->start_x() < b->start_x();
+        });
+    }
 
-        if ((tattr & 0x80) == 0 || !machine().is_cgb())
+    line.sprite_colors.fill(0);
+    line.sprite_attrs.fill(0);
+    for (auto it = order.begin(); it != end; ++it)
+    {
+        const Sprite* sprite = *it;
+        uint64_t row = sprite->pattern_row(config);
+        // lower priority pixels only show where the others are transparent
+        for (int scan_x = sprite->start_x(); row != 0; scan_x++, row >>= 8)
         {
-            // window on can be under sprites
-            if (window && scan_x >= window_x() - 7)
+            const uint8_t color = row & 0x3;
+            if (color != 0 && scan_x >= 0 && scan_x < SCREEN_W && line.sprite_colors[scan_x] == 0)
             {
-                const int wpx = scan_x - window_x() + 7;
-                const int wpy = scan_y - window_y();
-                // draw window pixel
-                const int wtile = wtd.tile_id(wpx / 8, wpy / 8);
-                const int wattr = wtd.tile_attr(wpx / 8, wpy / 8);
-                const int widx = wtd.pattern(wtile, wattr, wpx & 7, wpy & 7);
-                color15 = this->colorize_tile(tileconf, wattr, widx);
+                line.sprite_colors[scan_x] = color;
+                line.sprite_attrs[scan_x] = sprite->attributes();
             }
+        }
+    }
+}
 
-            // render sprites within this x
-            sprconf.scan_x = scan_x;
-            for (const auto* sprite : sprites)
-            {
-                const uint8_t idx = sprite->pixel(sprconf);
-                if (idx != 0)
-                {
-                    if (!sprite->behind() || tile_color == 0) {
-						color15 = this->colorize_sprite(sprite, sprconf, idx);
-					}
-                }
-            }
-        } // BG priority
-#ifndef GAMEBRO_INDEXED_FRAME
-		// Convert to 15-bit RGB
-		color15 = getpal(color15 * 2) | (getpal(color15 * 2 + 1) << 8);
-#endif
-        m_pixels.at(scan_y * SCREEN_W + scan_x) = color15;
-    } // x
-} // render_to(...)
+void GPU::render_tiles(const TileData& td, int x, int y, int begin, uint8_t* colors,
+                       uint8_t* attrs) const
+{
+    y &= 255;
+    // a tile row at a time, where the first one is cut short by the scroll
+    // offset within the tile, and the last one is stored past the end
+    for (int scan_x = begin; scan_x < SCREEN_W;)
+    {
+        const int sx = (scan_x + x) & 255;
+        const int tid = td.tile_id(sx / 8, y / 8);
+        const int tattr = td.tile_attr(sx / 8, y / 8);
+        const uint64_t row = td.pattern_row(tid, tattr, y & 7) >> (sx & 7) * 8;
+        std::memcpy(&colors[scan_x], &row, sizeof(row));
+        std::memset(&attrs[scan_x], tattr, sizeof(row));
+        scan_x += 8 - (sx & 7);
+    }
+}
 
 uint16_t GPU::colorize_tile(const tileconf_t& conf, const uint8_t attr, const uint8_t idx)
 {
@@ -247,19 +305,6 @@ uint16_t GPU::colorize_tile(const tileconf_t& conf, const uint8_t attr, const ui
     // no conversion
     return index;
 }
-uint16_t GPU::colorize_sprite(const Sprite* sprite, sprite_config_t& sprconf, const uint8_t idx)
-{
-    uint16_t index = 0;
-    if (machine().is_cgb()) {
-		index = 32 + 4 * sprite->cgb_pal() + idx;
-	}
-    else {
-        const uint8_t pal = sprconf.palette[sprite->pal()];
-        index = (pal >> (idx * 2)) & 0x3;
-    }
-    // no conversion
-    return index;
-}
 
 bool GPU::lcd_enabled() const noexcept { return m_reg_lcdc & 0x80; }
 bool GPU::window_enabled() const noexcept { return m_reg_lcdc & 0x20; }
@@ -274,18 +319,22 @@ uint16_t GPU::tile_data() const noexcept { return (m_reg_lcdc & 0x10) ? 0x8000 :
 TileData GPU::create_tiledata(uint16_t tiles, uint16_t patterns)
 {
     const bool is_signed = (m_reg_lcdc & 0x10) == 0;
-    const auto* vram = memory().video_ram_ptr();
+    const auto* vram0 = memory().video_bank_ptr(0);
+    const auto* vram1 = memory().video_bank_ptr(1);
     // printf("Background tiles: 0x%04x  Tile data: 0x%04x\n",
     //        bg_tiles(), tile_data());
-    const auto* tile_base = &vram[tiles - 0x8000];
-    const auto* patt_base = &vram[patterns - 0x8000];
+    const auto* tile_base = &vram0[tiles - 0x8000];
+    const auto* patt_base = &vram0[patterns - 0x8000];
+    const auto* patt_bank1 = &vram1[patterns - 0x8000];
+    const int first_tile = (patterns - 0x8000) / TileCache::PATTERN_SIZE;
     const uint8_t* attr_base = nullptr;
     if (machine().is_cgb())
     {
-        // attributes are always in VRAM bank 1 (which is off=0x2000)
-        attr_base = &vram[tiles - 0x8000 + 0x2000];
+        // attributes are always in VRAM bank 1
+        attr_base = &vram1[tiles - 0x8000];
     }
-    return TileData{tile_base, patt_base, attr_base, is_signed};
+    return TileData{m_tile_cache, tile_base, patt_base, patt_bank1, first_tile, attr_base,
+                    is_signed};
 }
 tileconf_t GPU::tile_config()
 {
@@ -297,7 +346,8 @@ tileconf_t GPU::tile_config()
 sprite_config_t GPU::sprite_config()
 {
     sprite_config_t config;
-    config.patterns = memory().video_ram_ptr();
+    config.patterns[0] = memory().video_bank_ptr(0);
+    config.patterns[1] = memory().video_bank_ptr(1);
     config.palette[0] = memory().read8(IO::REG_OBP0);
     config.palette[1] = memory().read8(IO::REG_OBP1);
     config.scan_x = 0;
@@ -307,23 +357,22 @@ sprite_config_t GPU::sprite_config()
     return config;
 }
 
-std::vector<const Sprite*> GPU::find_sprites(const sprite_config_t& config) const
+void GPU::bucket_sprites(const int height)
 {
-    const Sprite* sprite_begin = this->sprites_begin();
-    const Sprite* sprite_back = this->sprites_end() - 1;
-    std::vector<const Sprite*> results;
-    // draw sprites from right to left
-    for (const Sprite* sprite = sprite_back; sprite >= sprite_begin; sprite--)
+    for (auto& bucket : m_sprite_buckets) bucket.count = 0;
+    // the first 10 sprites on a scanline in OAM order are the ones shown,
+    // also when they are outside of the screen horizontally
+    const Sprite* sprites = this->sprites_begin();
+    for (int i = 0; i < 40; i++)
     {
-        if (sprite->hidden() == false)
-            if (sprite->is_within_scanline(config))
-            {
-                results.push_back(sprite);
-                // GB/GBC supports 10 sprites max per scanline
-                if (results.size() == 10) break;
-            }
+        const int end = std::min(SCREEN_H, sprites[i].start_y() + height);
+        for (int y = std::max(0, sprites[i].start_y()); y < end; y++)
+        {
+            auto& bucket = m_sprite_buckets[y];
+            if (bucket.count < bucket.sprites.size()) bucket.sprites[bucket.count++] = i;
+        }
     }
-    return results;
+    this->m_bucket_height = height;
 }
 const Sprite* GPU::sprites_begin() const noexcept { return &((Sprite*) memory().oam_ram_ptr())[0]; }
 const Sprite* GPU::sprites_end() const noexcept { return &((Sprite*) memory().oam_ram_ptr())[40]; }
@@ -341,8 +390,8 @@ std::vector<uint16_t> GPU::dump_background()
             // get the tile id
             const int tid = td.tile_id(x >> 3, y >> 3);
             const int tattr = td.tile_attr(x >> 3, y >> 3);
-            // copy the 16-byte tile into buffer
-            const int idx = td.pattern(tid, tattr, x & 7, y & 7);
+            // the decoded row, from the tile cache
+            const int idx = (td.pattern_row(tid, tattr, y & 7) >> (x & 7) * 8) & 0x3;
             data.at(y * 256 + x) = this->colorize_tile(tconf, tattr, idx);
         }
     return data;
@@ -359,8 +408,8 @@ std::vector<uint16_t> GPU::dump_tiles(int bank)
         for (int x = 0; x < 16 * 8; x++)
         {
             int tile = (y / 8) * 16 + (x / 8);
-            // copy the 16-byte tile into buffer
-            const int idx = td.pattern(tile, attr, x & 7, y & 7);
+            // the decoded row, from the tile cache
+            const int idx = (td.pattern_row(tile, attr, y & 7) >> (x & 7) * 8) & 0x3;
             data.at(y * 128 + x) = this->colorize_tile(tconf, attr, idx);
         }
     return data;
@@ -370,6 +419,7 @@ void GPU::set_video_bank(const uint8_t bank)
 {
     assert(bank < 2);
     this->m_state.video_offset = bank * 0x2000;
+    memory().remap(Memory::VideoRAM);
 }
 void GPU::lcd_power_changed(const bool online)
 {
@@ -392,6 +442,7 @@ void GPU::lcd_power_changed(const bool online)
         // theres a full white frame when turning on again
         this->m_state.white_frame = true;
     }
+    this->reschedule();
 }
 
 void GPU::setpal(uint16_t index, uint8_t value)
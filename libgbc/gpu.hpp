@@ -29,7 +29,11 @@ public:
 
     GPU(Machine&) noexcept;
     void reset() noexcept;
+    // scheduler event: mode changes and LY increments
     void simulate();
+    // catch up on the cycles since the last event (eg. before timing changes)
+    void sync();
+    void reschedule();
     // the vector is resized to exactly fit the screen
     const auto& pixels() const noexcept { return m_pixels; }
     // trap on palette changes
@@ -58,6 +62,13 @@ public:
 
     uint16_t video_offset() const noexcept { return m_state.video_offset; }
     void set_video_bank(uint8_t bank);
+    // OAM was written to, so the sprites on each scanline have to be found again
+    void oam_changed() noexcept { this->m_bucket_height = 0; }
+    // VRAM was written to at @offset, where bank 1 starts at 0x2000
+    void video_written(uint16_t offset) noexcept { m_tile_cache.written(offset); }
+    // all of OAM and VRAM may have changed, eg. after restoring a state
+    void memory_replaced() noexcept;
+    size_t tile_cache_footprint() const noexcept { return m_tile_cache.footprint(); }
     void lcd_power_changed(bool state);
 
     bool lcd_enabled() const noexcept;
@@ -87,19 +98,48 @@ public:
     const Sprite* sprites_begin() const noexcept;
     const Sprite* sprites_end() const noexcept;
 
+    // the layers of one scanline as one byte per pixel, with room for the
+    // last tile row to be stored past the end
+    struct scanline_t
+    {
+        alignas(32) std::array<uint8_t, SCREEN_W + 8> bg_colors;
+        alignas(32) std::array<uint8_t, SCREEN_W + 8> bg_attrs;
+        // the background with the window on top
+        alignas(32) std::array<uint8_t, SCREEN_W + 8> colors;
+        alignas(32) std::array<uint8_t, SCREEN_W + 8> attrs;
+        // the highest priority sprite pixel that is not transparent (color 0)
+        alignas(32) std::array<uint8_t, SCREEN_W> sprite_colors;
+        alignas(32) std::array<uint8_t, SCREEN_W> sprite_attrs;
+    };
+    // the palette index of each pixel in a scanline (see compositor.cpp),
+    // and the scalar version, which the vector paths must match
+    static void compose_indices(const scanline_t&, const tileconf_t&, const sprite_config_t&,
+                                uint8_t* indices);
+    static void compose_indices_scalar(const scanline_t&, const tileconf_t&,
+                                       const sprite_config_t&, uint8_t* indices);
+
 private:
+    void tick();
     uint64_t scanline_cycles() const noexcept;
     uint64_t oam_cycles() const noexcept;
     uint64_t vram_cycles() const noexcept;
     uint64_t hblank_cycles() const noexcept;
     void render_scanline(int y);
+    // tile color indices and attributes from @begin to the end of the line,
+    // where the line starts at (@x, @y) in the tile map
+    void render_tiles(const TileData&, int x, int y, int begin, uint8_t* colors,
+                      uint8_t* attrs) const;
+    // the sprite pixel with the highest priority at each position
+    void render_sprites(const sprite_config_t&, scanline_t&);
     void do_ly_comparison();
     TileData create_tiledata(uint16_t tiles, uint16_t patt);
     tileconf_t tile_config();
     sprite_config_t sprite_config();
-    std::vector<const Sprite*> find_sprites(const sprite_config_t&) const;
+    void bucket_sprites(int height);
     uint16_t colorize_tile(const tileconf_t&, uint8_t attr, uint8_t idx);
-    uint16_t colorize_sprite(const Sprite*, sprite_config_t&, uint8_t);
+    // palette priorities and lookups for a whole line (see compositor.cpp)
+    void compose_scanline(const scanline_t&, const tileconf_t&, const sprite_config_t&,
+                          PixelType* pixels) const;
     // addresses
     uint16_t bg_tiles() const noexcept;
     uint16_t window_tiles() const noexcept;
@@ -110,14 +150,25 @@ private:
     uint8_t& m_reg_lcdc;
     uint8_t& m_reg_stat;
     uint8_t& m_reg_ly;
+    TileCache m_tile_cache;
 	std::vector<PixelType> m_pixels;
     palchange_func_t m_on_palchange = nullptr;
     dmg_variant_t m_variant = LIGHTER_GREEN;
     bool m_render = true;
+    // the OAM indices of the sprites on each scanline, in OAM order
+    struct sprite_bucket_t
+    {
+        uint8_t count = 0;
+        std::array<uint8_t, 10> sprites;
+    };
+    std::array<sprite_bucket_t, SCREEN_H> m_sprite_buckets;
+    // the sprite height the buckets are for, or 0 when OAM has changed
+    int m_bucket_height = 0;
 
     struct state_t
     {
         uint64_t period = 0;
+        uint64_t last_sync = 0;
         uint64_t frame_count = 0;
         int current_scanline = 0;
         uint16_t video_offset = 0x0;
@@ -127,6 +178,12 @@ private:
     } m_state;
 };
 
+inline void GPU::memory_replaced() noexcept
+{
+    this->oam_changed();
+    this->m_tile_cache.invalidate();
+}
+
 inline std::array<uint32_t, 4> GPU::dmg_colors(dmg_variant_t variant)
 {
 #define mRGB(r, g, b) (r | (g << 8) | (b << 16))
@@ -1,9 +1,17 @@
 // only include this file once!
+#include "alu.hpp"
 #include "machine.hpp"
 #include "printers.hpp"
+#include <array>
+#include <utility>
+// handlers are specialized on their opcode, so that operand and
+// condition decoding happens at compile time
 #define DEF_INSTR(x)                                                                               \
-    static instruction_t instr_##x { handler_##x, printer_##x }
-#define INSTRUCTION(x) static void handler_##x
+    template <uint8_t opcode>                                                                      \
+    static constexpr instruction_t instr_##x{handler_##x<opcode>, printer_##x}
+#define INSTRUCTION(x)                                                                             \
+    template <uint8_t opcode>                                                                      \
+    static void handler_##x
 #define PRINTER(x) static int printer_##x
 union imm8_t
 {
@@ -25,7 +33,7 @@ PRINTER(LD_N_SP)(char* buffer, size_t len, CPU& cpu, const uint8_t)
     return snprintf(buffer, len, "LD (%04X), SP", cpu.peekop16(1));
 }
 
-INSTRUCTION(LD_R_N)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(LD_R_N)(CPU& cpu, const uint8_t)
 {
     cpu.registers().getreg_sp(opcode) = cpu.readop16();
 }
@@ -34,10 +42,11 @@ PRINTER(LD_R_N)(char* buffer, size_t len, CPU& cpu, uint8_t opcode)
     return snprintf(buffer, len, "LD %s, %04x", cstr_reg(opcode, true), cpu.peekop16(1));
 }
 
-INSTRUCTION(ADD_HL_R)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(ADD_HL_R)(CPU& cpu, const uint8_t)
 {
     auto& reg = cpu.registers().getreg_sp(opcode);
     auto& hl = cpu.registers().hl;
+    cpu.registers().resolve_flags();
     auto& flags = cpu.registers().flags;
     setflag(false, flags, MASK_NEGATIVE);
     setflag(((hl & 0x0fff) + (reg & 0x0fff)) & 0x1000, flags, MASK_HALFCARRY);
@@ -50,7 +59,7 @@ PRINTER(ADD_HL_R)(char* buffer, size_t len, CPU&, uint8_t opcode)
     return snprintf(buffer, len, "ADD HL, %s", cstr_reg(opcode, true));
 }
 
-INSTRUCTION(LD_R_A_R)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(LD_R_A_R)(CPU& cpu, const uint8_t)
 {
     if (opcode & 0x8) { cpu.registers().accum = cpu.mtread8(cpu.registers().getreg_sp(opcode)); }
     else
@@ -64,7 +73,7 @@ PRINTER(LD_R_A_R)(char* buffer, size_t len, CPU&, uint8_t opcode)
     return snprintf(buffer, len, "LD (%s), A", cstr_reg(opcode, true));
 }
 
-INSTRUCTION(INC_DEC_R)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(INC_DEC_R)(CPU& cpu, const uint8_t)
 {
     auto& reg = cpu.registers().getreg_sp(opcode);
     if ((opcode & 0x8) == 0) { reg++; }
@@ -80,7 +89,7 @@ PRINTER(INC_DEC_R)(char* buffer, size_t len, CPU&, uint8_t opcode)
     return snprintf(buffer, len, "DEC %s", cstr_reg(opcode, true));
 }
 
-INSTRUCTION(INC_DEC_D)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(INC_DEC_D)(CPU& cpu, const uint8_t)
 {
     const uint8_t dst = opcode >> 3;
     uint8_t value;
@@ -103,6 +112,7 @@ INSTRUCTION(INC_DEC_D)(CPU& cpu, const uint8_t opcode)
         }
         cpu.write_hl(value);
     }
+    cpu.registers().resolve_flags();
     auto& flags = cpu.registers().flags;
     setflag(opcode & 0x1, flags, MASK_NEGATIVE);
     setflag(value == 0, flags, MASK_ZERO); // set zero
@@ -117,7 +127,7 @@ PRINTER(INC_DEC_D)(char* buffer, size_t len, CPU&, uint8_t opcode)
     return snprintf(buffer, len, "%s %s", mnemonic, cstr_dest(opcode >> 3));
 }
 
-INSTRUCTION(LD_D_N)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(LD_D_N)(CPU& cpu, const uint8_t)
 {
     const uint8_t imm8 = cpu.readop8();
     if (((opcode >> 3) & 0x7) != 0x6) { cpu.registers().getdest(opcode >> 3) = imm8; }
@@ -134,51 +144,15 @@ PRINTER(LD_D_N)(char* buffer, size_t len, CPU& cpu, uint8_t opcode)
         return snprintf(buffer, len, "LD (HL=%04X), %02X", cpu.registers().hl, cpu.peekop8(1));
 }
 
-INSTRUCTION(RLC_RRC)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(RLC_RRC)(CPU& cpu, const uint8_t)
 {
-    auto& accum = cpu.registers().accum;
-    auto& flags = cpu.registers().flags;
-    switch (opcode)
-    {
-    case 0x07:
-    {
-        // RLCA, rotate A left
-        const uint8_t bit7 = accum & 0x80;
-        accum = (accum << 1) | (bit7 >> 7);
-        flags = 0;
-        setflag(bit7, flags, MASK_CARRY); // old bit7 to CF
-    }
-    break;
-    case 0x0F:
-    {
-        // RRCA, rotate A right
-        const uint8_t bit0 = accum & 0x1;
-        accum = (accum >> 1) | (bit0 << 7);
-        flags = 0;
-        setflag(bit0, flags, MASK_CARRY); // old bit0 to CF
-    }
-    break;
-    case 0x17:
-    {
-        // RLA, rotate A left, old CF to bit 0
-        const uint8_t bit7 = accum & 0x80;
-        accum = (accum << 1) | ((flags & MASK_CARRY) >> 4);
-        flags = 0;
-        setflag(bit7, flags, MASK_CARRY); // old bit7 to CF
-    }
-    break;
-    case 0x1F:
-    {
-        // RRA, rotate A right, old CF to bit 7
-        const uint8_t bit0 = accum & 0x1;
-        accum = (accum >> 1) | ((flags & MASK_CARRY) << 3);
-        flags = 0;
-        setflag(bit0, flags, MASK_CARRY); // old bit0 to CF
-    }
-    break;
-    default:
-        GBC_ASSERT(0 && "Unknown opcode in RLC/RRC handler");
-    }
+    // RLCA, RRCA, RLA and RRA are the CB rotates of A, but always clear Z
+    auto& regs = cpu.registers();
+    regs.resolve_flags();
+    const auto result =
+        ROTATE_TABLE[rotate_index(opcode >> 3, regs.accum, regs.flags & MASK_CARRY)];
+    regs.accum = result.value;
+    regs.flags = result.flags & MASK_CARRY;
 }
 PRINTER(RLC_RRC)(char* buffer, size_t len, CPU& cpu, uint8_t opcode)
 {
@@ -186,7 +160,7 @@ PRINTER(RLC_RRC)(char* buffer, size_t len, CPU& cpu, uint8_t opcode)
     return snprintf(buffer, len, "%s A (A = %02X)", mnemonic[opcode >> 3], cpu.registers().accum);
 }
 
-INSTRUCTION(LD_D_D)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(LD_D_D)(CPU& cpu, const uint8_t)
 {
     const bool HL = (opcode & 0x7) == 0x6;
     uint8_t reg;
@@ -206,7 +180,7 @@ PRINTER(LD_D_D)(char* buffer, size_t len, CPU&, uint8_t opcode)
     return snprintf(buffer, len, "LD %s, %s", cstr_dest(opcode >> 3), cstr_dest(opcode >> 0));
 }
 
-INSTRUCTION(LD_N_A_N)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(LD_N_A_N)(CPU& cpu, const uint8_t)
 {
     const uint16_t addr = cpu.readop16();
     if (opcode == 0xEA)
@@ -230,7 +204,7 @@ PRINTER(LD_N_A_N)(char* buffer, size_t len, CPU& cpu, uint8_t opcode)
         return snprintf(buffer, len, "LD A, (%04X)", cpu.peekop16(1));
 }
 
-INSTRUCTION(LDID_HL_A)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(LDID_HL_A)(CPU& cpu, const uint8_t)
 {
     if ((opcode & 0x8) == 0)
     {
@@ -260,22 +234,10 @@ PRINTER(LDID_HL_A)(char* buffer, size_t len, CPU& cpu, uint8_t opcode)
 INSTRUCTION(DAA)(CPU& cpu, const uint8_t)
 {
     auto& regs = cpu.registers();
-    if (regs.flags & MASK_NEGATIVE)
-    {
-        if (regs.flags & MASK_CARRY) regs.accum -= 0x60;
-        if (regs.flags & MASK_HALFCARRY) regs.accum -= 0x06;
-    }
-    else
-    {
-        if ((regs.flags & MASK_CARRY) || regs.accum > 0x99)
-        {
-            regs.accum += 0x60;
-            setflag(true, regs.flags, MASK_CARRY);
-        }
-        if ((regs.flags & MASK_HALFCARRY) || (regs.accum & 0xF) > 0x9) { regs.accum += 0x06; }
-    }
-    setflag(regs.accum == 0, regs.flags, MASK_ZERO);
-    setflag(false, regs.flags, MASK_HALFCARRY);
+    regs.resolve_flags();
+    const auto result = DAA_TABLE[daa_index(regs.accum, regs.flags)];
+    regs.accum = result.value;
+    regs.flags = (regs.flags & 0x0F) | result.flags;
 }
 PRINTER(DAA)(char* buffer, size_t len, CPU&, uint8_t) { return snprintf(buffer, len, "DAA"); }
 
@@ -283,13 +245,15 @@ INSTRUCTION(CPL_A)(CPU& cpu, const uint8_t)
 {
     cpu.registers().accum = ~cpu.registers().accum;
     auto& regs = cpu.registers();
+    regs.resolve_flags();
     setflag(true, regs.flags, MASK_NEGATIVE);
     setflag(true, regs.flags, MASK_HALFCARRY);
 }
 PRINTER(CPL_A)(char* buffer, size_t len, CPU&, uint8_t) { return snprintf(buffer, len, "CPL A"); }
 
-INSTRUCTION(SCF_CCF)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(SCF_CCF)(CPU& cpu, const uint8_t)
 {
+    cpu.registers().resolve_flags();
     auto& flags = cpu.registers().flags;
     if ((opcode & 0x8) == 0)
     {
@@ -310,7 +274,7 @@ PRINTER(SCF_CCF)(char* buffer, size_t len, CPU&, uint8_t opcode)
 }
 
 // ALU A, D / A, N
-INSTRUCTION(ALU_A_D)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(ALU_A_D)(CPU& cpu, const uint8_t)
 {
     const uint8_t alu_op = (opcode >> 3) & 0x7;
     // <alu> A, D
@@ -325,7 +289,7 @@ PRINTER(ALU_A_D)(char* buffer, size_t len, CPU&, uint8_t opcode)
     return snprintf(buffer, len, "%s A, %s", cstr_alu(opcode >> 3), cstr_dest(opcode));
 }
 
-INSTRUCTION(ALU_A_N)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(ALU_A_N)(CPU& cpu, const uint8_t)
 {
     const uint8_t alu_op = (opcode >> 3) & 0x7;
     // <alu> A, N
@@ -337,7 +301,7 @@ PRINTER(ALU_A_N)(char* buffer, size_t len, CPU& cpu, uint8_t opcode)
     return snprintf(buffer, len, "%s A, 0x%02x", cstr_alu(opcode >> 3), cpu.peekop8(1));
 }
 
-INSTRUCTION(JP)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(JP)(CPU& cpu, const uint8_t)
 {
     const uint16_t dest = cpu.readop16();
     if ((opcode & 1) || (cpu.registers().compare_flags(opcode)))
@@ -350,12 +314,14 @@ PRINTER(JP)(char* buffer, size_t len, CPU& cpu, uint8_t opcode)
 {
     if (opcode & 1) { return snprintf(buffer, len, "JP 0x%04x", cpu.peekop16(1)); }
     char temp[128];
-    fill_flag_buffer(temp, sizeof(temp), opcode, cpu.registers().flags);
+    fill_flag_buffer(temp, sizeof(temp), opcode, cpu.registers().current_flags());
     return snprintf(buffer, len, "JP 0x%04x (%s)", cpu.peekop16(1), temp);
 }
 
-INSTRUCTION(PUSH_POP)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(PUSH_POP)(CPU& cpu, const uint8_t)
 {
+    // AF needs the real flags, and POP AF overwrites them
+    if (((opcode >> 4) & 0x3) == 0x3) cpu.registers().resolve_flags();
     if (opcode & 4)
     {
         // PUSH R
@@ -375,6 +341,7 @@ INSTRUCTION(PUSH_POP)(CPU& cpu, const uint8_t opcode)
 }
 PRINTER(PUSH_POP)(char* buffer, size_t len, CPU& cpu, uint8_t opcode)
 {
+    cpu.registers().resolve_flags();
     if (opcode & 4)
     {
         return snprintf(buffer, len, "PUSH %s (0x%04x)", cstr_reg(opcode, false),
@@ -384,7 +351,7 @@ PRINTER(PUSH_POP)(char* buffer, size_t len, CPU& cpu, uint8_t opcode)
                     cpu.memory().read16(cpu.registers().sp));
 }
 
-INSTRUCTION(RET)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(RET)(CPU& cpu, const uint8_t)
 {
     if ((opcode & 0xef) == 0xc9 || cpu.registers().compare_flags(opcode))
     {
@@ -403,7 +370,7 @@ PRINTER(RET)(char* buffer, size_t len, CPU& cpu, uint8_t opcode)
 {
     if (opcode == 0xc9) { return snprintf(buffer, len, "RET"); }
     char temp[128];
-    fill_flag_buffer(temp, sizeof(temp), opcode, cpu.registers().flags);
+    fill_flag_buffer(temp, sizeof(temp), opcode, cpu.registers().current_flags());
     return snprintf(buffer, len, "RET %s", temp);
 }
 
@@ -418,7 +385,7 @@ INSTRUCTION(RETI)(CPU& cpu, const uint8_t)
 }
 PRINTER(RETI)(char* buffer, size_t len, CPU&, uint8_t) { return snprintf(buffer, len, "RETI"); }
 
-INSTRUCTION(RST)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(RST)(CPU& cpu, const uint8_t)
 {
     const uint16_t dst = opcode & 0x38;
     if (UNLIKELY(cpu.registers().pc == dst + 1))
@@ -449,7 +416,7 @@ INSTRUCTION(STOP)(CPU& cpu, const uint8_t)
 }
 PRINTER(STOP)(char* buffer, size_t len, CPU&, uint8_t) { return snprintf(buffer, len, "STOP"); }
 
-INSTRUCTION(JR_N)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(JR_N)(CPU& cpu, const uint8_t)
 {
     const imm8_t disp{.u8 = cpu.readop8()};
     cpu.hardware_tick();
@@ -463,7 +430,7 @@ PRINTER(JR_N)(char* buffer, size_t len, CPU& cpu, uint8_t opcode)
     if (opcode & 0x20)
     {
         char temp[128];
-        fill_flag_buffer(temp, sizeof(temp), opcode, cpu.registers().flags);
+        fill_flag_buffer(temp, sizeof(temp), opcode, cpu.registers().current_flags());
         return snprintf(buffer, len, "JR %+hhd (%s) => %04X", disp.s8, temp, dest);
     }
     return snprintf(buffer, len, "JR %+hhd => %04X", disp.s8, dest);
@@ -479,7 +446,7 @@ INSTRUCTION(HALT)(CPU& cpu, const uint8_t)
 }
 PRINTER(HALT)(char* buffer, size_t len, CPU&, uint8_t) { return snprintf(buffer, len, "HALT"); }
 
-INSTRUCTION(CALL)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(CALL)(CPU& cpu, const uint8_t)
 {
     const uint16_t dest = cpu.readop16();
     if ((opcode & 1) || cpu.registers().compare_flags(opcode))
@@ -492,7 +459,7 @@ PRINTER(CALL)(char* buffer, size_t len, CPU& cpu, uint8_t opcode)
 {
     if (opcode & 1) { return snprintf(buffer, len, "CALL %04X", cpu.peekop16(1)); }
     char temp[128];
-    fill_flag_buffer(temp, sizeof(temp), opcode, cpu.registers().flags);
+    fill_flag_buffer(temp, sizeof(temp), opcode, cpu.registers().current_flags());
     return snprintf(buffer, len, "CALL %04X (%s)", cpu.peekop16(1), temp);
 }
 
@@ -501,6 +468,7 @@ INSTRUCTION(ADD_SP_N)(CPU& cpu, const uint8_t)
     const imm8_t imm{.u8 = cpu.readop8()};
     auto& regs = cpu.registers();
     const int calc = (regs.sp + imm.s8) & 0xFFFF;
+    regs.resolve_flags();
     regs.flags = 0;
     setflag(((regs.sp ^ imm.s8 ^ calc) & 0x100) == 0x100, regs.flags, MASK_CARRY);
     setflag(((regs.sp ^ imm.s8 ^ calc) & 0x10) == 0x10, regs.flags, MASK_HALFCARRY);
@@ -513,7 +481,7 @@ PRINTER(ADD_SP_N)(char* buffer, size_t len, CPU& cpu, uint8_t)
     return snprintf(buffer, len, "ADD SP, 0x%02x", cpu.peekop8(1));
 }
 
-INSTRUCTION(LD_FF00_A)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(LD_FF00_A)(CPU& cpu, const uint8_t)
 {
     switch (opcode)
     {
@@ -548,12 +516,13 @@ PRINTER(LD_FF00_A)(char* buffer, size_t len, CPU& cpu, uint8_t opcode)
     GBC_ASSERT(0);
 }
 
-INSTRUCTION(LD_HL_SP)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(LD_HL_SP)(CPU& cpu, const uint8_t)
 {
     if (opcode == 0xF8)
     {
         // the ADD operation is signed
         const imm8_t imm{.u8 = cpu.readop8()};
+        cpu.registers().resolve_flags();
         cpu.registers().flags = 0;
         setflag(((cpu.registers().sp & 0xf) + (imm.u8 & 0x0f)) & 0x10, cpu.registers().flags,
                 MASK_HALFCARRY);
@@ -579,7 +548,7 @@ PRINTER(JP_HL)(char* buffer, size_t len, CPU& cpu, uint8_t)
     return snprintf(buffer, len, "JP HL (HL=%04X)", cpu.registers().hl);
 }
 
-INSTRUCTION(DI_EI)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(DI_EI)(CPU& cpu, const uint8_t)
 {
     if (opcode & 0x08) { cpu.enable_interrupts(); }
     else
@@ -593,9 +562,11 @@ PRINTER(DI_EI)(char* buffer, size_t len, CPU&, uint8_t opcode)
     return snprintf(buffer, len, "%s", mnemonic);
 }
 
-INSTRUCTION(CB_EXT)(CPU& cpu, const uint8_t)
+// CB-prefixed instructions, specialized on the second opcode byte
+template <uint8_t opcode> static inline void cb_instruction(CPU& cpu)
 {
-    const uint8_t opcode = cpu.readop8();
+    // everything but RES and SET updates the flags
+    if (opcode < 0x80) cpu.registers().resolve_flags();
     const bool HL = (opcode & 0x7) == 0x6;
     uint8_t reg;
     if (!HL)
@@ -627,94 +598,43 @@ INSTRUCTION(CB_EXT)(CPU& cpu, const uint8_t)
             break;
         }
     }
-    else if ((opcode & 0xF0) == 0x00)
-    {
-        auto& flags = cpu.registers().flags;
-        flags = 0;
-        if (opcode & 0x8)
-        {
-            // RRC D, rotate D right, keep old bit0
-            setflag(reg & 0x1, flags, MASK_CARRY); // old bit0 to CF
-            reg = (reg >> 1) | (reg << 7);
-        }
-        else
-        {
-            // RLC D, rotate D left, keep old bit7
-            setflag(reg & 0x80, flags, MASK_CARRY); // old bit7 to CF
-            reg = (reg << 1) | (reg >> 7);
-        }
-        setflag(reg == 0, cpu.registers().flags, MASK_ZERO);
-    }
-    else if ((opcode & 0xF0) == 0x10)
-    {
-        auto& flags = cpu.registers().flags;
-        // NOTE: dont reset flags here
-        if (opcode & 0x8)
-        {
-            // RR D, rotate D right through carry, old CF to bit 7
-            const uint8_t bit0 = reg & 0x1;
-            reg = (reg >> 1) | ((flags & MASK_CARRY) << 3);
-            flags = 0;
-            setflag(bit0, flags, MASK_CARRY); // old bit0 to CF
-        }
-        else
-        {
-            // RL D, rotate D left through carry, old CF to bit 0
-            const uint8_t bit7 = reg & 0x80;
-            reg = (reg << 1) | ((flags & MASK_CARRY) >> 4);
-            flags = 0;
-            setflag(bit7, flags, MASK_CARRY); // old bit7 to CF
-        }
-        setflag(reg == 0, flags, MASK_ZERO);
-    }
-    else if ((opcode & 0xF0) == 0x20)
-    {
-        auto& flags = cpu.registers().flags;
-        flags = 0;
-        if (opcode & 0x8)
-        {
-            // SRA D
-            setflag(reg & 0x1, flags, MASK_CARRY);
-            reg >>= 1;
-            reg |= (reg & 0x40) << 1;
-        }
-        else
-        {
-            // SLA D
-            setflag(reg & 0x80, flags, MASK_CARRY);
-            reg <<= 1;
-        }
-        setflag(reg == 0, cpu.registers().flags, MASK_ZERO);
-    }
-    else if ((opcode & 0xf0) == 0x30)
-    {
-        if ((opcode & 0x8) == 0x0)
-        {
-            // SWAP D
-            reg = (reg >> 4) | (reg << 4);
-            cpu.registers().flags = 0;
-            setflag(reg == 0, cpu.registers().flags, MASK_ZERO);
-        }
-        else
-        {
-            // SRL D (logical)
-            cpu.registers().flags = 0;
-            setflag(reg & 0x1, cpu.registers().flags, MASK_CARRY);
-            reg >>= 1;
-            setflag(reg == 0, cpu.registers().flags, MASK_ZERO);
-        }
-    }
     else
     {
-        fprintf(stderr, "Missing instruction: %#x\n", opcode);
-        GBC_ASSERT(0 && "Unimplemented extended instruction");
+        // RLC, RRC, RL, RR, SLA, SRA, SWAP and SRL
+        auto& flags = cpu.registers().flags;
+        const auto result = ROTATE_TABLE[rotate_index(opcode >> 3, reg, flags & MASK_CARRY)];
+        reg = result.value;
+        flags = result.flags;
     }
+
     // all instructions on this opcode go into the same dest
     if (!HL)
         cpu.registers().getdest(opcode) = reg;
     else
         cpu.write_hl(reg);
 }
+// a whole CB-prefixed instruction, for when the second byte is known ahead
+template <uint8_t opcode> static void handler_CB(CPU& cpu, const uint8_t)
+{
+    cpu.readop8();
+    cb_instruction<opcode>(cpu);
+}
+
+using cb_instruction_t = void (*)(CPU&);
+template <size_t... CB>
+static constexpr std::array<cb_instruction_t, 256> make_cb_table(std::index_sequence<CB...>)
+{
+    return {cb_instruction<CB>...};
+}
+template <size_t... CB>
+static constexpr std::array<handler_t, 256> make_cb_handlers(std::index_sequence<CB...>)
+{
+    return {handler_CB<CB>...};
+}
+static constexpr auto CB_TABLE = make_cb_table(std::make_index_sequence<256>{});
+static constexpr auto CB_HANDLERS = make_cb_handlers(std::make_index_sequence<256>{});
+
+INSTRUCTION(CB_EXT)(CPU& cpu, const uint8_t) { CB_TABLE[cpu.readop8()](cpu); }
 PRINTER(CB_EXT)(char* buffer, size_t len, CPU& cpu, uint8_t)
 {
     const uint8_t opcode = cpu.peekop8(1);
@@ -731,7 +651,7 @@ PRINTER(CB_EXT)(char* buffer, size_t len, CPU& cpu, uint8_t)
     }
 }
 
-INSTRUCTION(MISSING)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(MISSING)(CPU& cpu, const uint8_t)
 {
     fprintf(stderr, "Missing instruction: %#x\n", opcode);
     // pause for each instruction
@@ -43,24 +43,57 @@ void IO::reset()
     reg(REG_HDMA5) = 0xFF;
 
     this->m_state.reg_ie = 0x00;
+    this->m_state.divider_sync = machine().now();
 }
 
-void IO::simulate()
+void IO::sync()
 {
-    // 1. DIV timer
-    this->m_state.divider += 256 / 64;
-    this->reg(REG_DIV) = this->m_state.divider >> 8;
+    this->m_state.divider = this->divider();
+    this->m_state.divider_sync = machine().now();
+}
+void IO::reschedule()
+{
+    auto& scheduler = machine().scheduler;
+    this->schedule_timer();
+    // DMA transfers re-check their own conditions each event
+    if (this->dma_active())
+        scheduler.schedule(Scheduler::DMA_EVENT, machine().now() + 4);
+    if (this->hdma_active())
+        scheduler.schedule(Scheduler::HDMA_EVENT, machine().now() + 4);
+}
+
+static const std::array<int, 4> TIMA_CYCLES = {1024, 16, 64, 256};
+
+void IO::schedule_timer()
+{
+    auto& scheduler = machine().scheduler;
+    if ((this->reg(REG_TAC) & 0x4) == 0)
+    {
+        scheduler.cancel(Scheduler::TIMER_EVENT);
+        return;
+    }
+    const uint64_t now = machine().now();
+    // the TIMA reload happens over the next few ticks
+    if (UNLIKELY(this->m_state.timabug > 0))
+    {
+        scheduler.schedule(Scheduler::TIMER_EVENT, now + 4);
+        return;
+    }
+    // the next time the divider reaches a multiple of the TIMA period
+    const int period = TIMA_CYCLES[this->reg(REG_TAC) & 0x3];
+    scheduler.schedule(Scheduler::TIMER_EVENT, now + period - (this->divider() % period));
+}
 
-    // 2. TIMA timer
+void IO::timer_event()
+{
+    // TIMA timer
     if (this->reg(REG_TAC) & 0x4)
     {
-        const std::array<int, 4> TIMA_CYCLES = {1024, 16, 64, 256};
         const int speed = this->reg(REG_TAC) & 0x3;
         // TIMA counter timer
-        if (m_state.divider % (TIMA_CYCLES[speed]) == 0)
+        if (this->divider() % (TIMA_CYCLES[speed]) == 0)
         {
             this->reg(REG_TIMA)++;
-            // if (reg(REG_TIMA) > 16) machine().break_now();
             // timer interrupt when overflowing to 0
             if (this->reg(REG_TIMA) == 0)
             {
@@ -79,8 +112,12 @@ void IO::simulate()
             }
         }
     }
+    this->schedule_timer();
+}
 
-    // 3. OAM DMA operation
+void IO::dma_event()
+{
+    // OAM DMA operation
     if (this->m_state.dma.bytes_left > 0)
     {
         if (this->m_state.dma.slow_start > 0) { this->m_state.dma.slow_start--; }
@@ -94,10 +131,18 @@ void IO::simulate()
             { memory.write8(m_state.dma.dst++, memory.read8(m_state.dma.src++)); }
             assert(m_state.dma.bytes_left >= btw);
             m_state.dma.bytes_left -= btw;
+            // OAM is readable again
+            if (m_state.dma.bytes_left == 0) memory.remap(Memory::OAM_RAM);
         }
+        // one byte every tick until done
+        if (this->m_state.dma.bytes_left > 0)
+        { machine().scheduler.schedule(Scheduler::DMA_EVENT, machine().now() + 4); }
     }
+}
 
-    // 4. HDMA operation
+void IO::hdma_event()
+{
+    // HDMA operation
     if (this->hdma().bytes_left > 0)
     {
         // during H-blank, once for each line
@@ -188,6 +233,8 @@ void IO::start_dma(uint16_t src)
     oam_dma().src = src;
     oam_dma().dst = 0xfe00;
     oam_dma().bytes_left = 160; // 160 bytes total
+    machine().memory.remap(Memory::OAM_RAM);
+    machine().scheduler.schedule(Scheduler::DMA_EVENT, machine().now() + 4);
 }
 
 void IO::start_hdma(uint16_t src, uint16_t dst, uint16_t bytes)
@@ -196,6 +243,7 @@ void IO::start_hdma(uint16_t src, uint16_t dst, uint16_t bytes)
     hdma().dst = dst;
     hdma().bytes_left = bytes;
     hdma().cur_line = 0xff;
+    if (bytes > 0) machine().scheduler.schedule(Scheduler::HDMA_EVENT, machine().now() + 4);
 }
 
 void IO::perform_stop()
@@ -205,21 +253,33 @@ void IO::perform_stop()
     // remember previous LCD on/off value
     this->m_state.lcd_powered = reg(REG_LCDC) & 0x80;
     // disable LCD
+    machine().gpu.sync();
     reg(REG_LCDC) &= ~0x80;
+    machine().gpu.reschedule();
     // enable joypad interrupts
     this->m_state.reg_ie |= joypadint.mask;
 }
 void IO::deactivate_stop()
 {
     // turn screen back on, if it was turned off
+    machine().gpu.sync();
     if (this->m_state.lcd_powered) reg(REG_LCDC) |= 0x80;
+    machine().gpu.reschedule();
     reg(REG_KEY1) = machine().memory.double_speed() ? 0x80 : 0x0;
 }
 
+uint16_t IO::divider() const noexcept
+{
+    // the divider increases by 4 every hardware tick
+    return m_state.divider + (m_machine.now() - m_state.divider_sync);
+}
 void IO::reset_divider()
 {
     this->m_state.divider = 0;
+    this->m_state.divider_sync = machine().now();
     this->reg(REG_DIV) = 0;
+    // TIMA is clocked from the divider
+    this->schedule_timer();
 }
 
 int IO::restore_state(const std::vector<uint8_t>& data, int off)
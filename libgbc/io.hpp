@@ -96,12 +96,19 @@ public:
 
     void perform_stop();
     void deactivate_stop();
+    uint16_t divider() const noexcept;
     void reset_divider();
 
     Machine& machine() noexcept { return m_machine; }
 
     void reset();
-    void simulate();
+    // scheduler events
+    void timer_event();
+    void dma_event();
+    void hdma_event();
+    void sync();
+    void reschedule();
+    void schedule_timer();
 
     inline uint8_t& reg(const uint16_t addr) { return m_state.ioregs[addr & 0x7f]; }
     inline const uint8_t& reg(const uint16_t addr) const { return m_state.ioregs[addr & 0x7f]; }
@@ -152,7 +159,9 @@ private:
     {
         std::array<uint8_t, 128> ioregs = {};
         joypad_t joypad;
+        // divider value at the time of the last sync
         uint16_t divider = 0;
+        uint64_t divider_sync = 0;
         uint16_t timabug = 0;
         // LCD on/off during STOP?
         bool lcd_powered = false;
@@ -38,11 +38,25 @@ void iowrite_DIV(IO& io, uint16_t, uint8_t)
     // writing to DIV resets it to 0
     io.reset_divider();
 }
-uint8_t ioread_DIV(IO& io, uint16_t) { return io.reg(IO::REG_DIV); }
+uint8_t ioread_DIV(IO& io, uint16_t)
+{
+    // the divider is only brought up to date when read
+    io.reg(IO::REG_DIV) = io.divider() >> 8;
+    return io.reg(IO::REG_DIV);
+}
+
+void iowrite_TAC(IO& io, uint16_t addr, uint8_t value)
+{
+    io.reg(addr) = value;
+    io.schedule_timer();
+}
+uint8_t ioread_TAC(IO& io, uint16_t addr) { return io.reg(addr); }
 
 void iowrite_LCDC(IO& io, uint16_t addr, uint8_t value)
 {
     const bool was_enabled = io.reg(addr) & 0x80;
+    // the GPU has to catch up before the LCD changes power state
+    if (was_enabled != bool(value & 0x80)) io.machine().gpu.sync();
     io.reg(addr) = value;
     const bool is_enabled = io.reg(addr) & 0x80;
     // check if LCD just turned on
@@ -214,6 +228,7 @@ __attribute__((constructor)) static void set_io_handlers()
 {
     IOHANDLER(IO::REG_P1, JOYP);
     IOHANDLER(IO::REG_DIV, DIV);
+    IOHANDLER(IO::REG_TAC, TAC);
     IOHANDLER(IO::REG_LCDC, LCDC);
     IOHANDLER(IO::REG_STAT, STAT);
     IOHANDLER(IO::REG_DMA, DMA);
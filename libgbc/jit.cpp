@@ -0,0 +1,488 @@
+#include "jit.hpp"
+
+#include "machine.hpp"
+#include <cstddef>
+#include <cstring>
+#include <exception>
+#if defined(__x86_64__) && defined(__unix__)
+#include <sys/mman.h>
+#define GAMEBRO_JIT_X64 1
+#endif
+
+namespace gbc
+{
+#ifdef GAMEBRO_JIT_X64
+// the last argument is where in the block to start executing
+using native_t = void (*)(CPU*, regs_t*, uint64_t*, const uint8_t*, const uint64_t*, uint8_t*);
+
+// x86 LAHF (SF ZF - AF - PF - CF) to Z - H C
+static constexpr struct flag_table_t
+{
+    uint8_t value[256];
+    constexpr flag_table_t() : value()
+    {
+        for (int ah = 0; ah < 256; ah++)
+        {
+            value[ah] = ((ah & 0x40) ? MASK_ZERO : 0) | ((ah & 0x10) ? MASK_HALFCARRY : 0) |
+                        ((ah & 0x01) ? MASK_CARRY : 0);
+        }
+    }
+} FLAG_TABLE;
+
+static const uint8_t REG_A = offsetof(regs_t, accum);
+static const uint8_t REG_F = offsetof(regs_t, flags);
+static const uint8_t REG_HL = offsetof(regs_t, hl);
+static const uint8_t REG_PC = offsetof(regs_t, pc);
+// same order as regs_t::getdest(), with (HL) as 0xFF
+static const uint8_t DEST_OFFSET[8] = {
+    offsetof(regs_t, b), offsetof(regs_t, c), offsetof(regs_t, d),     offsetof(regs_t, e),
+    offsetof(regs_t, h), offsetof(regs_t, l), 0xFF, offsetof(regs_t, accum)};
+static const uint8_t PAIR_OFFSET[4] = {offsetof(regs_t, bc), offsetof(regs_t, de),
+                                       offsetof(regs_t, hl), offsetof(regs_t, sp)};
+
+// the exception thrown by an instruction handler, rethrown outside of native code
+static thread_local std::exception_ptr callout_exception = nullptr;
+
+// Register usage in translated code:
+//   rbp = CPU*, rbx = regs_t*, r13 = &cycles_total,
+//   r14 = FLAG_TABLE, r15 = &next scheduler event
+//   rax, rcx, rdx, rsi, rdi are scratch
+struct Emitter
+{
+    std::vector<uint8_t> code;
+    std::vector<size_t> labels;
+    std::vector<std::pair<size_t, int>> fixups;
+
+    void emit(std::initializer_list<uint8_t> bytes) { code.insert(code.end(), bytes); }
+    void imm16(uint16_t v) { emit({uint8_t(v), uint8_t(v >> 8)}); }
+    void imm32(uint32_t v)
+    {
+        emit({uint8_t(v), uint8_t(v >> 8), uint8_t(v >> 16), uint8_t(v >> 24)});
+    }
+    void imm64(uint64_t v)
+    {
+        imm32(v);
+        imm32(v >> 32);
+    }
+    int label()
+    {
+        labels.push_back(SIZE_MAX);
+        return labels.size() - 1;
+    }
+    void bind(int label) { labels.at(label) = code.size(); }
+    void rel32(int label)
+    {
+        fixups.emplace_back(code.size(), label);
+        imm32(0);
+    }
+    void jmp(int label)
+    {
+        emit({0xE9});
+        rel32(label);
+    }
+    // 0x84 = jz, 0x85 = jnz, 0x83 = jae
+    void jcc(uint8_t cc, int label)
+    {
+        emit({0x0F, cc});
+        rel32(label);
+    }
+    void link()
+    {
+        for (const auto& fix : fixups)
+        {
+            const int32_t rel = labels.at(fix.second) - (fix.first + 4);
+            memcpy(&code[fix.first], &rel, 4);
+        }
+    }
+    // mov al, [rbx+off] and mov [rbx+off], al
+    void load_al(uint8_t off) { emit({0x8A, 0x43, off}); }
+    void store_al(uint8_t off) { emit({0x88, 0x43, off}); }
+    void load_cl(uint8_t off) { emit({0x8A, 0x4B, off}); }
+    void load_dl(uint8_t off) { emit({0x8A, 0x53, off}); }
+    // mov word [rbx+off], imm16
+    void store_imm16(uint8_t off, uint16_t v)
+    {
+        emit({0x66, 0xC7, 0x43, off});
+        imm16(v);
+    }
+    void store_pc(uint16_t pc) { store_imm16(REG_PC, pc); }
+    // F = FLAG_TABLE[lahf] | @set, keeping the bits in @keep
+    void lahf_flags(uint8_t set, uint8_t keep, uint8_t mask = 0xF0)
+    {
+        emit({0x9F});                         // lahf
+        emit({0x0F, 0xB6, 0xC4});             // movzx eax, ah
+        emit({0x41, 0x0F, 0xB6, 0x04, 0x06}); // movzx eax, byte [r14+rax]
+        if (mask != 0xF0) emit({0x24, mask}); // and al, mask
+        if (set) emit({0x0C, set});           // or al, set
+        if (keep)
+        {
+            load_cl(REG_F);
+            emit({0x80, 0xE1, keep}); // and cl, keep
+            emit({0x08, 0xC8});       // or al, cl
+        }
+        store_al(REG_F);
+    }
+    // F = (result == 0 ? Z : 0) | @set
+    void zero_flag(uint8_t set)
+    {
+        emit({0x84, 0xC0});               // test al, al
+        emit({0x0F, 0x94, 0xC1});         // setz cl
+        emit({0xC0, 0xE1, 0x07});         // shl cl, 7
+        if (set) emit({0x80, 0xC9, set}); // or cl, set
+        emit({0x88, 0x4B, REG_F});        // mov [rbx+F], cl
+    }
+    void call(const void* func)
+    {
+        emit({0x48, 0xB8}); // mov rax, imm64
+        imm64((uintptr_t) func);
+        emit({0xFF, 0xD0}); // call rax
+    }
+};
+
+bool JIT::is_supported() noexcept { return true; }
+
+JIT::JIT(CPU& cpu) : m_cpu(cpu)
+{
+    void* code =
+        mmap(nullptr, CODE_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) throw MachineException("JIT: Unable to allocate code memory");
+    this->m_code = (uint8_t*) code;
+    this->m_generation = cpu.block_cache().generation();
+}
+JIT::~JIT() { munmap(m_code, CODE_SIZE); }
+
+void JIT::reset()
+{
+    for (block_t* block : m_translated)
+    {
+        block->native = nullptr;
+        block->entries.clear();
+        block->hits = 0;
+    }
+    m_translated.clear();
+    m_used = 0;
+}
+
+bool JIT::execute(block_t& block, const size_t index)
+{
+    auto& cpu = this->m_cpu;
+    // RAM can be self-modifying, so it is always interpreted
+    if (block.key & 0x80000000) return false;
+    // the interpreter takes care of everything that is checked between instructions
+    if (UNLIKELY(cpu.m_state.intr_pending != 0 || cpu.m_break || !cpu.m_breakpoints.empty() ||
+                 cpu.m_break_steps_cnt != 0 || cpu.machine().verbose_instructions))
+        return false;
+    // translations die with their blocks
+    if (UNLIKELY(m_generation != cpu.block_cache().generation()))
+    {
+        m_translated.clear();
+        m_used = 0;
+        m_generation = cpu.block_cache().generation();
+    }
+    if (block.native == nullptr)
+    {
+        // only count entries from the top of the block
+        if (index != 0 || ++block.hits < HOT_THRESHOLD) return false;
+        if (!this->translate(block)) return false;
+        m_translated.push_back(&block);
+    }
+    // translated code works on the flags register directly
+    cpu.registers().resolve_flags();
+    auto func = (native_t) block.native;
+    func(&cpu, &cpu.registers(), &cpu.m_state.cycles_total, FLAG_TABLE.value,
+         &cpu.machine().scheduler.next_event(), block.native + block.entries.at(index));
+    if (UNLIKELY(callout_exception != nullptr))
+    {
+        auto exception = callout_exception;
+        callout_exception = nullptr;
+        std::rethrow_exception(exception);
+    }
+    return true;
+}
+
+int JIT::callout(CPU* cpu, const decoded_t* instr)
+{
+    auto& machine = cpu->machine();
+    const uint64_t dispatches = machine.scheduler.dispatches();
+    const uint32_t rombank = cpu->memory().mbc().rombank_offset();
+    try
+    {
+        cpu->m_cache.issue(*instr);
+        cpu->registers().pc = instr->pc + 1;
+        cpu->hardware_tick();
+        instr->handler(*cpu, instr->opcode());
+        cpu->registers().resolve_flags();
+        cpu->m_cache.retire();
+    }
+    catch (...)
+    {
+        callout_exception = std::current_exception();
+        return 1;
+    }
+    // return to the interpreter whenever it would have noticed something
+    return machine.scheduler.dispatches() != dispatches ||
+           cpu->memory().mbc().rombank_offset() != rombank || cpu->m_state.intr_pending != 0 ||
+           (cpu->ime() && machine.io.interrupt_mask() != 0) || cpu->is_halting() ||
+           cpu->is_stopping() || cpu->m_break || !machine.is_running();
+}
+
+void JIT::ticks(CPU* cpu, int count)
+{
+    try
+    {
+        while (count--) cpu->hardware_tick();
+    }
+    catch (...)
+    {
+        callout_exception = std::current_exception();
+    }
+}
+
+bool JIT::translate(block_t& block)
+{
+    Emitter e;
+    const int epilogue = e.label();
+    std::vector<std::pair<int, int>> slow_ticks;
+    // advance time by @count ticks, leaving when an event is due
+    auto emit_ticks = [&](const int count) {
+        const int slow = e.label();
+        slow_ticks.emplace_back(slow, count);
+        e.emit({0x49, 0x8B, 0x45, 0x00});               // mov rax, [r13]
+        e.emit({0x48, 0x83, 0xC0, uint8_t(4 * count)}); // add rax, 4*count
+        e.emit({0x49, 0x3B, 0x07});                     // cmp rax, [r15]
+        e.jcc(0x83, slow);                              // jae slow
+        e.emit({0x49, 0x89, 0x45, 0x00});               // mov [r13], rax
+    };
+
+    // prologue: 5 pushes keep the stack 16-byte aligned for calls
+    e.emit({0x53, 0x55, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57});
+    e.emit({0x48, 0x89, 0xFD}); // mov rbp, rdi
+    e.emit({0x48, 0x89, 0xF3}); // mov rbx, rsi
+    e.emit({0x49, 0x89, 0xD5}); // mov r13, rdx
+    e.emit({0x49, 0x89, 0xCE}); // mov r14, rcx
+    e.emit({0x4D, 0x89, 0xC7}); // mov r15, r8
+    e.emit({0x41, 0xFF, 0xE1}); // jmp r9
+
+    std::vector<uint32_t> entries;
+    for (const auto& instr : block.instr)
+    {
+        entries.push_back(e.code.size());
+        const uint8_t opcode = instr.opcode();
+        const uint16_t next = instr.pc + instr.length;
+        const uint8_t dst = DEST_OFFSET[(opcode >> 3) & 0x7];
+        const uint8_t src = DEST_OFFSET[opcode & 0x7];
+
+        if (opcode == 0x00) // NOP
+        {
+            e.store_pc(next);
+            emit_ticks(1);
+        }
+        else if (opcode >= 0x40 && opcode < 0x80 && dst != 0xFF && src != 0xFF) // LD D, D
+        {
+            e.load_al(src);
+            e.store_al(dst);
+            e.store_pc(next);
+            emit_ticks(1);
+        }
+        else if ((opcode & 0xC7) == 0x06 && dst != 0xFF) // LD D, imm8
+        {
+            e.emit({0xC6, 0x43, dst, instr.bytes[1]});
+            e.store_pc(next);
+            emit_ticks(2);
+        }
+        else if ((opcode & 0xCF) == 0x01) // LD R, imm16
+        {
+            e.store_imm16(PAIR_OFFSET[opcode >> 4], instr.bytes[1] | (instr.bytes[2] << 8));
+            e.store_pc(next);
+            emit_ticks(3);
+        }
+        else if ((opcode & 0xC7) == 0x03) // INC R, DEC R
+        {
+            // inc/dec word [rbx+off]
+            e.emit({0x66, 0xFF, uint8_t((opcode & 0x8) ? 0x4B : 0x43),
+                    PAIR_OFFSET[(opcode >> 4) & 0x3]});
+            e.store_pc(next);
+            emit_ticks(2);
+        }
+        else if ((opcode & 0xC6) == 0x04 && dst != 0xFF) // INC D, DEC D
+        {
+            const bool dec = opcode & 0x1;
+            e.emit({0xFE, uint8_t(dec ? 0x4B : 0x43), dst}); // inc/dec byte [rbx+dst]
+            e.lahf_flags(dec ? MASK_NEGATIVE : 0, 0x1F, MASK_ZERO | MASK_HALFCARRY);
+            e.store_pc(next);
+            emit_ticks(1);
+        }
+        else if ((opcode >= 0x80 && opcode < 0xC0 && src != 0xFF) || (opcode & 0xC7) == 0xC6)
+        {
+            // ALU A, D and ALU A, imm8
+            const bool imm = opcode >= 0xC0;
+            const uint8_t op = (opcode >> 3) & 0x7;
+            e.load_al(REG_A);
+            if (imm)
+                e.emit({0xB2, instr.bytes[1]}); // mov dl, imm8
+            else
+                e.load_dl(src);
+            if (op == ADC || op == SBC)
+            {
+                // move the carry flag into CF
+                e.load_cl(REG_F);
+                e.emit({0xC0, 0xE9, 0x05}); // shr cl, 5
+            }
+            // add, adc, sub, sbb, and, xor, or, cmp al, dl
+            static const uint8_t ALU_OPS[8] = {0x00, 0x10, 0x28, 0x18, 0x20, 0x30, 0x08, 0x38};
+            e.emit({ALU_OPS[op], 0xD0});
+            if (op != CP) e.store_al(REG_A);
+            switch (op)
+            {
+            case ADD:
+            case ADC:
+                e.lahf_flags(0, 0x0F);
+                break;
+            case SUB:
+            case CP:
+                e.lahf_flags(MASK_NEGATIVE, 0x0F);
+                break;
+            case SBC:
+                e.lahf_flags(MASK_NEGATIVE, 0);
+                break;
+            case AND:
+                e.zero_flag(MASK_HALFCARRY);
+                break;
+            default: // XOR, OR
+                e.zero_flag(0);
+                break;
+            }
+            e.store_pc(next);
+            emit_ticks(imm ? 2 : 1);
+        }
+        else if (opcode == 0x2F) // CPL A
+        {
+            e.load_al(REG_A);
+            e.emit({0xF6, 0xD0}); // not al
+            e.store_al(REG_A);
+            e.emit({0x80, 0x4B, REG_F, MASK_NEGATIVE | MASK_HALFCARRY}); // or byte [rbx+F]
+            e.store_pc(next);
+            emit_ticks(1);
+        }
+        else if (opcode == 0x37 || opcode == 0x3F) // SCF, CCF
+        {
+            e.load_al(REG_F);
+            if (opcode == 0x37)
+            {
+                e.emit({0x24, 0x8F});       // and al, ~(N | H)
+                e.emit({0x0C, MASK_CARRY}); // or al, C
+            }
+            else
+            {
+                e.emit({0x24, 0x9F});       // and al, ~(N | H)
+                e.emit({0x34, MASK_CARRY}); // xor al, C
+            }
+            e.store_al(REG_F);
+            e.store_pc(next);
+            emit_ticks(1);
+        }
+        else if (opcode == 0x18 || (opcode & 0xE7) == 0x20) // JR
+        {
+            const uint16_t dest = next + (int8_t) instr.bytes[1];
+            if (opcode == 0x18)
+                e.store_pc(dest);
+            else
+            {
+                const int not_taken = e.label();
+                const uint8_t flag = (opcode & 0x10) ? MASK_CARRY : MASK_ZERO;
+                e.store_pc(next);
+                e.emit({0xF6, 0x43, REG_F, flag}); // test byte [rbx+F], flag
+                e.jcc((opcode & 0x08) ? 0x84 : 0x85, not_taken);
+                e.store_pc(dest);
+                e.bind(not_taken);
+            }
+            emit_ticks(3);
+            e.jmp(epilogue);
+        }
+        else if (opcode == 0xC3 || (opcode & 0xE7) == 0xC2) // JP
+        {
+            const uint16_t dest = instr.bytes[1] | (instr.bytes[2] << 8);
+            if (opcode != 0xC3)
+            {
+                const int not_taken = e.label();
+                const uint8_t flag = (opcode & 0x10) ? MASK_CARRY : MASK_ZERO;
+                e.store_pc(next);
+                e.emit({0xF6, 0x43, REG_F, flag}); // test byte [rbx+F], flag
+                e.jcc((opcode & 0x08) ? 0x84 : 0x85, not_taken);
+                e.store_pc(dest);
+                emit_ticks(4);
+                e.jmp(epilogue);
+                e.bind(not_taken);
+                emit_ticks(3);
+                e.jmp(epilogue);
+            }
+            else
+            {
+                e.store_pc(dest);
+                emit_ticks(4);
+                e.jmp(epilogue);
+            }
+        }
+        else if (opcode == 0xE9) // JP HL
+        {
+            e.emit({0x66, 0x8B, 0x43, REG_HL}); // mov ax, [rbx+HL]
+            e.emit({0x66, 0x89, 0x43, REG_PC}); // mov [rbx+PC], ax
+            emit_ticks(1);
+            e.jmp(epilogue);
+        }
+        else
+        {
+            // everything else is run by the instruction handler
+            e.emit({0x48, 0x89, 0xEF}); // mov rdi, rbp
+            e.emit({0x48, 0xBE});       // mov rsi, imm64
+            e.imm64((uintptr_t) &instr);
+            e.call((const void*) &JIT::callout);
+            e.emit({0x85, 0xC0}); // test eax, eax
+            e.jcc(0x85, epilogue);
+        }
+    }
+
+    e.bind(epilogue);
+    e.emit({0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x5D, 0x5B, 0xC3});
+    // running events leaves the block, as the interpreter checks interrupts
+    for (const auto& slow : slow_ticks)
+    {
+        e.bind(slow.first);
+        e.emit({0x48, 0x89, 0xEF}); // mov rdi, rbp
+        e.emit({0xBE});             // mov esi, imm32
+        e.imm32(slow.second);
+        e.call((const void*) &JIT::ticks);
+        e.jmp(epilogue);
+    }
+    e.link();
+
+    if (m_used + e.code.size() > CODE_SIZE)
+    {
+        // out of code space: start over
+        this->reset();
+        if (e.code.size() > CODE_SIZE) return false;
+    }
+    uint8_t* dest = &m_code[m_used];
+    if (mprotect(m_code, CODE_SIZE, PROT_READ | PROT_WRITE) != 0) return false;
+    memcpy(dest, e.code.data(), e.code.size());
+    mprotect(m_code, CODE_SIZE, PROT_READ | PROT_EXEC);
+    // keep entry points 16-byte aligned
+    m_used += (e.code.size() + 15) & ~size_t(15);
+    block.native = dest;
+    block.entries = std::move(entries);
+    return true;
+}
+
+#else
+
+bool JIT::is_supported() noexcept { return false; }
+JIT::JIT(CPU& cpu) : m_cpu(cpu) {}
+JIT::~JIT() {}
+void JIT::reset() {}
+bool JIT::execute(block_t&, size_t) { return false; }
+bool JIT::translate(block_t&) { return false; }
+int JIT::callout(CPU*, const decoded_t*) { return 1; }
+void JIT::ticks(CPU*, int) {}
+
+#endif
+} // namespace gbc
@@ -0,0 +1,48 @@
+#pragma once
+#include "common.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace gbc
+{
+class CPU;
+struct block_t;
+struct decoded_t;
+
+// Translates hot basic blocks of ROM code into native x86-64 code.
+// Register and branch instructions are emitted inline, everything that
+// touches memory calls the regular instruction handler. A translated block
+// returns to the interpreter after any instruction that dispatched events
+// or made an interrupt pending, so it is observably identical to it.
+class JIT
+{
+public:
+    // blocks are translated after being entered this many times
+    static const uint32_t HOT_THRESHOLD = 32;
+    static const size_t CODE_SIZE = 4 << 20;
+
+    JIT(CPU&);
+    ~JIT();
+    // false when there is no backend for this host
+    static bool is_supported() noexcept;
+
+    // run @block natively from instruction @index if it is hot enough,
+    // otherwise return false
+    bool execute(block_t& block, size_t index);
+    size_t code_used() const noexcept { return m_used; }
+
+private:
+    bool translate(block_t&);
+    void reset();
+    // called from translated code
+    static int callout(CPU*, const decoded_t*);
+    static void ticks(CPU*, int count);
+
+    CPU& m_cpu;
+    uint8_t* m_code = nullptr;
+    size_t m_used = 0;
+    uint32_t m_generation = 0;
+    std::vector<block_t*> m_translated;
+};
+} // namespace gbc
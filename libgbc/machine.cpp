@@ -2,22 +2,41 @@
 
 namespace gbc
 {
-Machine::Machine(const std::string_view rom, bool init)
-    : cpu(*this), memory(*this, rom), io(*this), gpu(*this), apu(*this)
+Machine::Machine(std::shared_ptr<const Rom> rom, bool init)
+    : scheduler(*this), cpu(*this), memory(*this, *rom), io(*this), gpu(*this), apu(*this),
+      m_rom(rom)
 {
     // set CGB mode when ROM supports it
     const uint8_t cgb = memory.read8(0x143);
     this->m_cgb_mode = (cgb & 0x80) && ENABLE_GBC;
     // reset CPU now that we know the machine type
     if (init) this->cpu.reset();
+    // every device exists now, so accesses can bypass the slow path
+    memory.remap();
+    this->reschedule();
 }
 
+Machine::Machine(const std::string_view rom, bool init) : Machine(Rom::view(rom), init) {}
+
 void Machine::reset()
 {
+    // lazily simulated devices must catch up before time restarts
+    gpu.sync();
+    io.sync();
     cpu.reset();
     memory.reset();
     io.reset();
     gpu.reset();
+    cpu.block_cache().flush();
+    memory.remap();
+    this->reschedule();
+}
+void Machine::reschedule()
+{
+    scheduler.reset();
+    gpu.reschedule();
+    io.reschedule();
+    apu.reschedule();
 }
 void Machine::stop() noexcept { this->m_running = false; }
 
@@ -51,6 +70,16 @@ void Machine::set_handler(interrupt i, interrupt_handler handler)
 
 void Machine::set_inputs(uint8_t mask) { io.trigger_keys(mask); }
 
+size_t Machine::memory_footprint() const
+{
+    size_t bytes = sizeof(Machine) + memory.footprint();
+    bytes += gpu.pixels().capacity() * sizeof(gpu.pixels()[0]);
+    bytes += gpu.tile_cache_footprint();
+    bytes += cpu.block_cache().footprint();
+    if (cpu.jit() != nullptr) bytes += cpu.jit()->code_used();
+    return bytes;
+}
+
 size_t Machine::restore_state(const std::vector<uint8_t>& data)
 {
     int offset = 0;
@@ -59,8 +88,35 @@ size_t Machine::restore_state(const std::vector<uint8_t>& data)
     offset += io.restore_state(data, offset);
     offset += gpu.restore_state(data, offset);
     offset += apu.restore_state(data, offset);
+    // RAM and banks have changed underneath any decoded code
+    cpu.block_cache().flush();
+    memory.remap();
+    this->reschedule();
     return offset;
 }
+std::unique_ptr<Machine> Machine::fork()
+{
+    auto child = std::make_unique<Machine>(m_rom, false);
+    // everything but memory is small enough to just copy
+    std::vector<uint8_t> state;
+    cpu.serialize_state(state);
+    io.serialize_state(state);
+    gpu.serialize_state(state);
+    apu.serialize_state(state);
+    int offset = 0;
+    offset += child->cpu.restore_state(state, offset);
+    offset += child->io.restore_state(state, offset);
+    offset += child->gpu.restore_state(state, offset);
+    offset += child->apu.restore_state(state, offset);
+    child->memory.fork_from(this->memory);
+    child->m_running = this->m_running;
+    child->cpu.block_cache().flush();
+    child->memory.remap();
+    child->reschedule();
+    // writes to the shared pages must make copies from now on
+    this->memory.remap();
+    return child;
+}
 void Machine::serialize_state(std::vector<uint8_t>& result) const
 {
     cpu.serialize_state(result);
@@ -70,6 +126,28 @@ void Machine::serialize_state(std::vector<uint8_t>& result) const
     apu.serialize_state(result);
 }
 
+size_t Machine::restore_changes(const std::vector<uint8_t>& data)
+{
+    int offset = 0;
+    offset += cpu.restore_state(data, offset);
+    offset += memory.restore_changes(data, offset);
+    offset += io.restore_state(data, offset);
+    offset += gpu.restore_state(data, offset);
+    offset += apu.restore_state(data, offset);
+    cpu.block_cache().flush();
+    memory.remap();
+    this->reschedule();
+    return offset;
+}
+void Machine::serialize_changes(std::vector<uint8_t>& result, uint32_t epoch) const
+{
+    cpu.serialize_state(result);
+    memory.serialize_changes(result, epoch);
+    io.serialize_state(result);
+    gpu.serialize_state(result);
+    apu.serialize_state(result);
+}
+
 void Machine::break_now() { cpu.break_now(); }
 bool Machine::is_breaking() const noexcept { return cpu.is_breaking(); }
 
@@ -6,6 +6,8 @@
 #include "interrupt.hpp"
 #include "io.hpp"
 #include "memory.hpp"
+#include "rom.hpp"
+#include "scheduler.hpp"
 
 namespace gbc
 {
@@ -27,7 +29,10 @@ public:
     Machine(const std::string_view rom, bool init = true);
     Machine(const std::vector<uint8_t>& rom, bool init = true)
         : Machine(std::string_view{(const char *)rom.data(), rom.size()}, init) {}
+    // share one mapped or compressed ROM image between many machines
+    Machine(std::shared_ptr<const Rom> rom, bool init = true);
 
+    Scheduler scheduler;
     CPU cpu;
     Memory memory;
     IO io;
@@ -38,8 +43,14 @@ public:
     void simulate_one_frame();
     void reset();
     uint64_t now() noexcept;
+    // run hot ROM code through the x86-64 recompiler (off by default)
+    void enable_jit(bool enabled) { cpu.enable_jit(enabled); }
+    bool jit_enabled() const noexcept { return cpu.jit() != nullptr; }
     bool is_running() const noexcept { return this->m_running; }
     bool is_cgb() const noexcept { return this->m_cgb_mode; }
+    // approximate bytes used by this machine, including allocated RAM pages,
+    // the pixel buffer and cached code, but not the ROM image
+    size_t memory_footprint() const;
 
     // set delegates to be notified on interrupts
     enum interrupt
@@ -57,6 +68,15 @@ public:
     // serialization (state-keeping)
     size_t restore_state(const std::vector<uint8_t>&);
     void   serialize_state(std::vector<uint8_t>&) const;
+    // incremental serialization: start a new epoch, and later serialize the
+    // machine with only the RAM written since the start of that epoch.
+    // Changes must be restored on top of the state they were made from.
+    uint32_t new_epoch() { return memory.new_epoch(); }
+    size_t restore_changes(const std::vector<uint8_t>&);
+    void   serialize_changes(std::vector<uint8_t>&, uint32_t epoch) const;
+    // a new machine in the same state, sharing RAM with this one copy-on-write,
+    // without the handlers, breakpoints or JIT of this one
+    std::unique_ptr<Machine> fork();
 
     /// debugging aids ///
     bool verbose_instructions = false;
@@ -72,8 +92,13 @@ public:
     void stop() noexcept;
 
 private:
+    // recalculate every device deadline from the current device state
+    void reschedule();
+
     bool m_running = true;
     bool m_cgb_mode = false;
+    // keeps the ROM image alive, which only refers to the data of a plain view
+    std::shared_ptr<const Rom> m_rom = nullptr;
 };
 
 inline void Machine::simulate() { cpu.simulate(); }
@@ -6,25 +6,71 @@
 #include "mbc1m.hpp"
 #include "mbc3.hpp"
 #include "mbc5.hpp"
+#include <chrono>
 
 namespace gbc
 {
-MBC::MBC(Memory& m, const std::string_view rom)
-    : m_memory(m), m_rom(rom) {}
+MBC::MBC(Memory& m, const Rom& rom)
+    : m_memory(m), m_rom(rom)
+{
+    if (m_rom.compressed())
+    {
+        auto bank0 = std::make_shared<Rom::bank_t>();
+        m_rom.decompress(0, *bank0);
+        this->m_rom_bank0 = std::move(bank0);
+        this->m_rombank0 = m_rom_bank0->data();
+    }
+    else
+    {
+        this->m_rombank0 = m_rom.bank(0);
+    }
+    this->m_rombankx = this->rom_bank(m_state.rom_bank_offset / rombank_size());
+}
+
+const uint8_t* MBC::rom_bank(size_t n)
+{
+    if (!m_rom.compressed()) return m_rom.bank(n);
+    n %= m_rom.banks();
+    rom_cache_t* victim = &m_rom_cache[0];
+    for (auto& entry : m_rom_cache)
+    {
+        if (entry.number == int32_t(n))
+        {
+            entry.used = ++m_rom_clock;
+            return entry.bank->data();
+        }
+        if (entry.used < victim->used) victim = &entry;
+    }
+    // the bank mapped right now was used last, so it is never the one replaced
+    auto bank = std::make_shared<Rom::bank_t>();
+    m_rom.decompress(n, *bank);
+    *victim = {std::move(bank), int32_t(n), ++m_rom_clock};
+    return victim->bank->data();
+}
+
+size_t MBC::footprint() const noexcept
+{
+    size_t bytes = m_ram.footprint();
+    if (m_rom_bank0 != nullptr) bytes += Rom::BANK_SIZE / m_rom_bank0.use_count();
+    for (const auto& entry : m_rom_cache)
+        if (entry.bank != nullptr) bytes += Rom::BANK_SIZE / entry.bank.use_count();
+    return bytes;
+}
 
 void MBC::init()
 {
-    this->m_ram.at(0x100) = 0x1;
-    this->m_ram.at(0x101) = 0x3;
-    this->m_ram.at(0x102) = 0x5;
-    this->m_ram.at(0x103) = 0x7;
-    this->m_ram.at(0x104) = 0x9;
     // test ROMs are just instruction arrays
     if (m_rom.size() < 0x150) return;
     // parse ROM header
     switch (m_memory.read8(0x147))
     {
-    case 0x0:
+    case 0x0: // no MBC
+    case 0x8:
+    case 0x9:
+        this->m_state.version = 0;
+        // without an MBC to enable it, any cartridge RAM is always there
+        this->m_state.ram_enabled = true;
+        break;
     case 0x1: // MBC 1
     case 0x2:
     case 0x3:
@@ -85,44 +131,107 @@ void MBC::init()
         break;
     }
     // printf("RAM bank size: 0x%05x\n", m_state.ram_bank_size);
+    // RAM is allocated on first write, so cartridges without RAM get none
+    if (m_state.ram_bank_size > 0x104)
+    {
+        this->m_ram.write(CART_RAM + 0x100, 0x1);
+        this->m_ram.write(CART_RAM + 0x101, 0x3);
+        this->m_ram.write(CART_RAM + 0x102, 0x5);
+        this->m_ram.write(CART_RAM + 0x103, 0x7);
+        this->m_ram.write(CART_RAM + 0x104, 0x9);
+    }
     this->m_state.wram_size = 0x8000;
     // printf("Work RAM bank size: 0x%04x\n", m_state.wram_size);
+    this->select_mapper();
+}
+void MBC::select_mapper()
+{
+    switch (this->m_state.version)
+    {
+    case 5:
+        this->m_write_control = &MBC::write_MBC5;
+        break;
+    case 3:
+        this->m_write_control = &MBC::write_MBC3;
+        break;
+    case 1:
+        this->m_write_control = &MBC::write_MBC1M;
+        break;
+    case 0:
+        this->m_write_control = &MBC::write_none; // no MBC
+        break;
+    default:
+        assert(0 && "Unimplemented MBC version");
+        this->m_write_control = &MBC::write_none;
+    }
 }
 
 uint8_t MBC::read(uint16_t addr)
+{
+    const int32_t offset = this->page_offset(addr & 0xFF00);
+    if (offset >= 0) return this->m_ram.read(offset + (addr & 0xFF));
+    if (addr >= RAMbankX.first && addr < RAMbankX.second)
+    {
+        if (this->ram_enabled() && m_state.rtc_enabled) return this->rtc_read();
+        return 0xff; // disabled or missing cartridge RAM
+    }
+    if (UNLIKELY(addr < RAMbankX.first || addr >= EchoRAM.second))
+        printf("* Invalid MBC read: 0x%04x\n", addr);
+    return 0xff;
+}
+
+int32_t MBC::page_offset(uint16_t addr) const noexcept
 {
     switch (addr & 0xF000)
     {
     case 0xA000:
     case 0xB000:
-        if (this->ram_enabled())
-        {
-            if (this->m_state.rtc_enabled == false)
-            {
-                addr -= RAMbankX.first;
-                addr |= this->m_state.ram_bank_offset;
-                if (addr < this->m_state.ram_bank_size) return this->m_ram.at(addr);
-                return 0xff; // small 2kb RAM banks
-            }
-            else
-            {
-                return 0xff; // TODO: Read from RTC register
-            }
-        }
-        else
+        if (this->ram_enabled() && this->m_state.rtc_enabled == false)
         {
-            return 0xff;
+            addr -= RAMbankX.first;
+            addr |= this->m_state.ram_bank_offset;
+            if (addr + 0x100u <= this->m_state.ram_bank_size) return CART_RAM + addr;
         }
+        return -1;
     case 0xC000:
-        return this->m_state.wram.at(addr - WRAM_0.first);
+        return addr - WRAM_0.first;
     case 0xD000:
-        return m_state.wram.at(m_state.wram_offset + addr - WRAM_bX.first);
+        return m_state.wram_offset + addr - WRAM_bX.first;
     case 0xE000: // echo RAM
     case 0xF000:
-        return this->read(addr - 0x2000);
+        return this->page_offset(addr - 0x2000);
     }
-    printf("* Invalid MBC read: 0x%04x\n", addr);
-    return 0xff;
+    return -1;
+}
+// what cartridge RAM reads as while it is disabled or missing
+static const std::array<uint8_t, 256> no_ram_page = []
+{
+    std::array<uint8_t, 256> page;
+    page.fill(0xff);
+    return page;
+}();
+
+bool MBC::ram_unmapped(uint16_t addr) const noexcept
+{
+    return addr >= RAMbankX.first && addr < RAMbankX.second &&
+           !(m_state.ram_enabled && m_state.rtc_enabled);
+}
+const uint8_t* MBC::read_page(uint16_t addr) const noexcept
+{
+    const int32_t offset = this->page_offset(addr & 0xFF00);
+    if (offset < 0) return this->ram_unmapped(addr) ? no_ram_page.data() : nullptr;
+    return m_ram.page(offset / m_ram.PAGE_SIZE) + offset % m_ram.PAGE_SIZE;
+}
+uint8_t* MBC::write_page(uint16_t addr) noexcept
+{
+    const int32_t offset = this->page_offset(addr & 0xFF00);
+    if (offset < 0) return this->ram_unmapped(addr) ? m_discard.data() : nullptr;
+    return m_ram.write_pointer(offset);
+}
+bool MBC::page_shared(uint16_t addr) const noexcept
+{
+    const int32_t offset = this->page_offset(addr & 0xFF00);
+    return offset >= 0 && m_ram.shared(offset / m_ram.PAGE_SIZE);
 }
 
 void MBC::write(uint16_t addr, uint8_t value)
@@ -131,7 +240,10 @@ void MBC::write(uint16_t addr, uint8_t value)
     {
     case 0x0000:
     case 0x1000:
-        // RAM enable
+    {
+        // RAM enable, which needs an MBC
+        if (m_state.version == 0) return;
+        const bool was_enabled = this->m_state.ram_enabled;
         if (m_state.version == 2)
             this->m_state.ram_enabled = value != 0;
         else
@@ -139,7 +251,11 @@ void MBC::write(uint16_t addr, uint8_t value)
         if (UNLIKELY(verbose_banking())) {
             printf("* External RAM enabled: %d\n", this->m_state.ram_enabled);
         }
+        // games disable RAM when they are done saving
+        if (was_enabled && !m_state.ram_enabled && m_battery != nullptr) this->sync_battery();
+        this->m_memory.remap(Memory::BankRAM);
         return;
+    }
     case 0x2000:
     case 0x3000:
     case 0x4000:
@@ -147,45 +263,21 @@ void MBC::write(uint16_t addr, uint8_t value)
     case 0x6000:
     case 0x7000:
         // MBC control ranges
-        switch (this->m_state.version)
-        {
-        case 5:
-            this->write_MBC5(addr, value);
-            break;
-        case 3:
-            this->write_MBC3(addr, value);
-            break;
-        case 1:
-            this->write_MBC1M(addr, value);
-            break;
-        case 0:
-            break; // no MBC
-        default:
-            assert(0 && "Unimplemented MBC version");
-        }
+        (this->*m_write_control)(addr, value);
         return;
     case 0xA000:
     case 0xB000:
-        if (this->ram_enabled())
-        {
-            if (this->m_state.rtc_enabled == false)
-            {
-                addr -= RAMbankX.first;
-                addr |= this->m_state.ram_bank_offset;
-                if (addr < this->m_state.ram_bank_size) { this->m_ram.at(addr) = value; }
-            }
-            else
-            {
-                // TODO: Write to RTC register
-            }
-        }
-        return;
-    case 0xC000: // WRAM bank 0
-        this->m_state.wram.at(addr - WRAM_0.first) = value;
-        return;
-    case 0xD000: // WRAM bank X
-        this->m_state.wram.at(m_state.wram_offset + addr - WRAM_bX.first) = value;
+    case 0xC000:
+    case 0xD000:
+    {
+        const int32_t offset = this->page_offset(addr & 0xFF00);
+        if (offset >= 0)
+            this->m_ram.write(offset + (addr & 0xFF), value);
+        else if (addr < WRAM_0.first && this->ram_enabled() && m_state.rtc_enabled)
+            this->rtc_write(value);
+        // otherwise disabled or missing cartridge RAM
         return;
+    }
     case 0xE000: // Echo RAM
     case 0xF000:
         this->write(addr - 0x2000, value);
@@ -212,6 +304,9 @@ void MBC::set_rombank(int reg)
         return;
     }
     this->m_state.rom_bank_offset = offset;
+    this->m_rombankx = this->rom_bank(reg);
+    this->m_memory.remap({ROMbankX.first, ROMbankX.second - 1});
+    this->m_memory.machine().cpu.block_cache().bank_switched();
 }
 void MBC::set_rambank(int reg)
 {
@@ -226,6 +321,7 @@ void MBC::set_rambank(int reg)
                m_state.ram_bank_size);
     }
     this->m_state.ram_bank_offset = offset;
+    this->m_memory.remap(Memory::BankRAM);
 }
 void MBC::set_wrambank(int reg)
 {
@@ -240,6 +336,8 @@ void MBC::set_wrambank(int reg)
         return;
     }
     this->m_state.wram_offset = offset;
+    this->m_memory.remap({WRAM_bX.first, WRAM_bX.second - 1});
+    this->m_memory.machine().cpu.block_cache().bank_switched();
 }
 void MBC::set_mode(int mode)
 {
@@ -259,21 +357,149 @@ void MBC::set_mode(int mode)
     }
 }
 
+// MBC3 real-time clock
+static constexpr std::array<uint8_t, 5> RTC_MASK{0x3F, 0x3F, 0x1F, 0xFF, 0xC1};
+
+std::pair<uint64_t, uint64_t> MBC::rtc_clock() const
+{
+    // the current time, and the number of time units per second
+    if (m_state.rtc.host_clock)
+    {
+        const auto now = std::chrono::system_clock::now().time_since_epoch();
+        return {std::chrono::duration_cast<std::chrono::microseconds>(now).count(), 1000000};
+    }
+    return {m_memory.machine().cpu.gettime(), 4194304ull * m_memory.speed_factor()};
+}
+void MBC::rtc_update()
+{
+    if (m_state.version != 3) return;
+    auto& rtc = m_state.rtc;
+    const auto [now, rate] = this->rtc_clock();
+    // a halted clock stays where it is, as does one that went backwards
+    if ((rtc.regs[4] & 0x40) || now < rtc.time)
+    {
+        rtc.time = now;
+        return;
+    }
+    const uint64_t seconds = (now - rtc.time) / rate;
+    rtc.time += seconds * rate;
+    if (seconds > 0) this->rtc_advance(seconds);
+}
+void MBC::rtc_advance(uint64_t seconds)
+{
+    auto& r = m_state.rtc.regs;
+    uint64_t days = r[3] | (r[4] & 0x1) << 8;
+    // out-of-range values count up to where their bits wrap around, without
+    // carrying into the next register, so they are stepped one second at a time
+    for (; seconds > 0 && (r[0] > 59 || r[1] > 59 || r[2] > 23); seconds--)
+    {
+        r[0] = (r[0] + 1) & 0x3F;
+        if (r[0] != 60) continue;
+        r[0] = 0;
+        r[1] = (r[1] + 1) & 0x3F;
+        if (r[1] != 60) continue;
+        r[1] = 0;
+        r[2] = (r[2] + 1) & 0x1F;
+        if (r[2] != 24) continue;
+        r[2] = 0;
+        days++;
+    }
+    if (seconds > 0)
+    {
+        const uint64_t time = r[0] + 60 * (r[1] + 60 * r[2]) + seconds;
+        r[0] = time % 60;
+        r[1] = time / 60 % 60;
+        r[2] = time / 3600 % 24;
+        days += time / 86400;
+    }
+    // the 9-bit day counter sets a sticky carry bit when it overflows
+    if (days > 0x1FF) r[4] |= 0x80;
+    r[3] = days & 0xFF;
+    r[4] = (r[4] & 0xFE) | ((days >> 8) & 0x1);
+}
+void MBC::rtc_speed_changed(int old_factor)
+{
+    auto& rtc = m_state.rtc;
+    if (m_state.version != 3 || rtc.host_clock) return;
+    // keep the part of the current second that has passed already
+    const uint64_t now = m_memory.machine().cpu.gettime();
+    rtc.time = now - (now - rtc.time) * m_memory.speed_factor() / old_factor;
+}
+uint8_t MBC::rtc_read() const noexcept
+{
+    return m_state.rtc.latched[m_state.rtc.select - 0x08];
+}
+void MBC::rtc_write(uint8_t value)
+{
+    this->rtc_update();
+    auto& rtc = m_state.rtc;
+    const int reg = rtc.select - 0x08;
+    rtc.regs[reg] = value & RTC_MASK[reg];
+    rtc.latched[reg] = rtc.regs[reg];
+    // writing the seconds restarts the current second
+    if (reg == 0) rtc.time = this->rtc_clock().first;
+}
+void MBC::rtc_latch(uint8_t value)
+{
+    // writing 0 and then 1 copies the clock into the readable registers
+    if (m_state.rtc.latch == 0x0 && value == 0x1)
+    {
+        this->rtc_update();
+        m_state.rtc.latched = m_state.rtc.regs;
+    }
+    m_state.rtc.latch = value;
+}
+void MBC::use_host_clock(bool enabled)
+{
+    this->rtc_update();
+    m_state.rtc.host_clock = enabled;
+    m_state.rtc.time = this->rtc_clock().first;
+}
+
 bool MBC::verbose_banking() const noexcept { return m_memory.machine().verbose_banking; }
 
+void MBC::fork_from(const MBC& other)
+{
+    this->m_state = other.m_state;
+    this->m_ram = other.m_ram;
+    // decompressed banks never change, so they can be shared
+    this->m_rom_cache = other.m_rom_cache;
+    this->m_rombankx = this->rom_bank(m_state.rom_bank_offset / rombank_size());
+    this->select_mapper();
+    // only the original machine writes to its battery file
+    if (other.m_battery != nullptr)
+        for (size_t n = CART_RAM / m_ram.PAGE_SIZE; n < m_ram.PAGES; n++) m_ram.detach(n);
+}
+
 // serialization
 int MBC::restore_state(const std::vector<uint8_t>& data, int off)
 {
     // copy state first
     this->m_state = *(state_t*) &data.at(off);
     off += sizeof(state_t);
-    // then copy RAM by size
-    std::copy(&data.at(off), &data.at(off) + m_state.ram_bank_size, m_ram.begin());
-    return sizeof(state_t) + m_state.ram_bank_size;
+    this->m_rombankx = this->rom_bank(m_state.rom_bank_offset / rombank_size());
+    this->select_mapper();
+    // then work RAM, and cartridge RAM by size
+    const size_t bytes = CART_RAM + m_state.ram_bank_size;
+    this->m_ram.restore(&data.at(off), 0, bytes);
+    return sizeof(state_t) + bytes;
 }
 void MBC::serialize_state(std::vector<uint8_t>& res) const
 {
     res.insert(res.end(), (uint8_t*) &m_state, (uint8_t*) &m_state + sizeof(m_state));
-    res.insert(res.end(), m_ram.begin(), m_ram.begin() + m_state.ram_bank_size);
+    this->m_ram.serialize(res, 0, CART_RAM + m_state.ram_bank_size);
+}
+int MBC::restore_changes(const std::vector<uint8_t>& data, int off)
+{
+    this->m_state = *(state_t*) &data.at(off);
+    off += sizeof(state_t);
+    this->m_rombankx = this->rom_bank(m_state.rom_bank_offset / rombank_size());
+    this->select_mapper();
+    return sizeof(state_t) + this->m_ram.restore_changes(data, off);
+}
+void MBC::serialize_changes(std::vector<uint8_t>& res, uint32_t epoch) const
+{
+    res.insert(res.end(), (uint8_t*) &m_state, (uint8_t*) &m_state + sizeof(m_state));
+    this->m_ram.serialize_changes(res, epoch);
 }
 } // namespace gbc
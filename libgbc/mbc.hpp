@@ -1,8 +1,12 @@
 #pragma once
+#include "pages.hpp"
+#include "rom.hpp"
 #include <array>
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <string>
 #include <string_view>
 #include <vector>
 
@@ -21,10 +25,14 @@ public:
     static constexpr range_t WRAM_bX{0xD000, 0xE000};
     static constexpr range_t EchoRAM{0xE000, 0xFE00};
 
-    MBC(Memory&, const std::string_view rom);
+    MBC(Memory&, const Rom& rom);
 
-    const auto& rom() const noexcept { return m_rom; }
+    const Rom& rom() const noexcept { return m_rom; }
     uint32_t rombank_offset() const noexcept { return m_state.rom_bank_offset; }
+    // the ROM banks mapped at 0x0000-0x3FFF and 0x4000-0x7FFF
+    const uint8_t* rombank0() const noexcept { return m_rombank0; }
+    const uint8_t* rombankx() const noexcept { return m_rombankx; }
+    uint16_t wrambank_offset() const noexcept { return m_state.wram_offset; }
 
     bool ram_enabled() const noexcept { return m_state.ram_enabled; }
     size_t rombank_size() const noexcept { return 0x4000; }
@@ -33,24 +41,84 @@ public:
 
     uint8_t read(uint16_t addr);
     void write(uint16_t addr, uint8_t value);
+    // the 256 bytes of cartridge or work RAM at @addr, or nullptr when
+    // accesses there have to go through read() and write(), which includes
+    // writes to pages still shared with a forked machine, and the first write
+    // to each page in an epoch. Disabled or missing cartridge RAM reads as
+    // 0xFF from a constant page, and writes there go nowhere.
+    const uint8_t* read_page(uint16_t addr) const noexcept;
+    uint8_t* write_page(uint16_t addr) noexcept;
+    // true when a write to @addr allocates its RAM page, or copies it away
+    // from a forked machine, which moves every memory page within it
+    bool page_shared(uint16_t addr) const noexcept;
 
     void set_rombank(int offset);
     void set_rambank(int offset);
     void set_wrambank(int offset);
     void set_mode(int mode);
 
+    // keep cartridge RAM in a battery save file mapped from @filename, which
+    // is created from the current RAM if it is empty, and loaded otherwise.
+    // Writes go straight to the file, and are flushed when RAM is disabled.
+    void attach_battery(const std::string& filename);
+    bool has_battery() const noexcept { return m_battery != nullptr; }
+    void sync_battery();
+
+    // the MBC3 clock counts emulated time by default, which keeps runs
+    // deterministic at any speed, or it can follow the host clock instead
+    void use_host_clock(bool enabled);
+    bool host_clock() const noexcept { return m_state.rtc.host_clock; }
+
+    // become a copy of @other, sharing its RAM pages copy-on-write, except
+    // for the pages of a battery file
+    void fork_from(const MBC& other);
+    // bytes of work and cartridge RAM allocated so far, and of decompressed ROM
+    size_t footprint() const noexcept;
+
     // serialization
     int restore_state(const std::vector<uint8_t>&, int);
     void serialize_state(std::vector<uint8_t>&) const;
+    uint32_t next_epoch() noexcept { return m_ram.next_epoch(); }
+    int restore_changes(const std::vector<uint8_t>&, int);
+    void serialize_changes(std::vector<uint8_t>&, uint32_t epoch) const;
 
 private:
     void write_MBC1M(uint16_t, uint8_t);
     void write_MBC3(uint16_t, uint8_t);
     void write_MBC5(uint16_t, uint8_t);
+    void write_none(uint16_t, uint8_t) {}
+    // pick the control register handler for the cartridge once, up front
+    void select_mapper();
     bool verbose_banking() const noexcept;
+    int32_t page_offset(uint16_t addr) const noexcept;
+    bool ram_unmapped(uint16_t addr) const noexcept;
+    // ROM bank @n, decompressed into the bank cache if the ROM is compressed
+    const uint8_t* rom_bank(size_t n);
+    // MBC3 real-time clock, brought up to date only when it is accessed
+    void rtc_update();
+    void rtc_advance(uint64_t seconds);
+    void rtc_speed_changed(int old_factor);
+    std::pair<uint64_t, uint64_t> rtc_clock() const;
+    uint8_t rtc_read() const noexcept;
+    void rtc_write(uint8_t value);
+    void rtc_latch(uint8_t value);
 
     Memory& m_memory;
-    const std::string_view m_rom;
+    const Rom& m_rom;
+    const uint8_t* m_rombank0;
+    const uint8_t* m_rombankx;
+    // banks of a compressed ROM: bank 0 is always there, and the others are
+    // kept in a small cache, replacing the least recently used bank first
+    static constexpr size_t ROM_CACHE_BANKS = 8;
+    struct rom_cache_t
+    {
+        std::shared_ptr<const Rom::bank_t> bank = nullptr;
+        int32_t number = -1;
+        uint64_t used = 0;
+    };
+    std::shared_ptr<const Rom::bank_t> m_rom_bank0 = nullptr;
+    std::array<rom_cache_t, ROM_CACHE_BANKS> m_rom_cache;
+    uint64_t m_rom_clock = 0;
     struct state_t
     {
         uint32_t rom_bank_offset = 0x4000;
@@ -65,10 +133,26 @@ private:
         uint16_t rom_bank_reg = 0x1;
         uint8_t mode_select = 0;
         uint8_t version = 1;
-        std::array<uint8_t, 32768> wram;
+        struct rtc_t
+        {
+            // seconds, minutes, hours, day counter low and high
+            std::array<uint8_t, 5> regs = {};
+            std::array<uint8_t, 5> latched = {};
+            uint8_t select = 0x08;  // register mapped at 0xA000, 0x08-0x0C
+            uint8_t latch = 0xFF;   // last value written to the latch register
+            bool host_clock = false;
+            uint64_t time = 0;      // clock time the registers are current at
+        } rtc;
     } m_state;
-    // RAM is so big we want to deal with it dynamically
-    std::array<uint8_t, 131072> m_ram;
+    // work RAM, followed by cartridge RAM, allocated one page at a time as
+    // they are written, so DMG games never allocate work RAM banks 2-7
+    static constexpr uint32_t CART_RAM = 0x8000;
+    SharedPages<0x1000, 40> m_ram;
+    void (MBC::*m_write_control)(uint16_t, uint8_t) = &MBC::write_MBC1M;
+    // where writes to disabled cartridge RAM end up
+    std::array<uint8_t, 256> m_discard;
+    struct battery_t;
+    std::shared_ptr<battery_t> m_battery = nullptr;
 
     friend class Memory;
     void init();
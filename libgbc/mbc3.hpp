@@ -17,12 +17,21 @@ inline void MBC::write_MBC3(uint16_t addr, uint8_t value)
         return;
     case 0x4000:
     case 0x5000:
-        this->set_rambank(value & 0x7);
-        this->m_state.rtc_enabled = (value & 0x80);
+        // RAM bank, or one of the clock registers
+        this->m_state.rtc_enabled = (value >= 0x08 && value <= 0x0C);
+        if (this->m_state.rtc_enabled)
+        {
+            this->m_state.rtc.select = value;
+            this->m_memory.remap(Memory::BankRAM);
+        }
+        else
+        {
+            this->set_rambank(value & 0x7);
+        }
         return;
     case 0x6000:
     case 0x7000:
-        // TODO: RTC latch values
+        this->rtc_latch(value);
         return;
     }
 }
@@ -1,10 +1,12 @@
 #include "memory.hpp"
 #include "machine.hpp"
+#include "rom.hpp"
+#include <algorithm>
 
 namespace gbc
 {
-Memory::Memory(Machine& mach, const std::string_view rom)
-    : m_machine(mach), m_rom(rom), m_mbc{*this, rom}
+Memory::Memory(Machine& mach, const Rom& rom)
+    : m_machine(mach), m_mbc{*this, rom}
 {
     assert(this->rom_valid());
     this->disable_bootrom();
@@ -17,14 +19,125 @@ void Memory::reset()
 }
 bool Memory::rom_valid() const noexcept
 {
-    // TODO: implement me
-    return true;
+    // test ROMs are just instruction arrays
+    const Rom& rom = m_mbc.rom();
+    if (rom.size() < 0x150) return true;
+    // compressed images are checked when they are loaded
+    return rom.compressed() || Rom::header_valid(rom.data());
 }
 void Memory::disable_bootrom() { m_state.bootrom_enabled = false; }
 
 void Memory::set_wram_bank(uint8_t bank) { this->m_mbc.set_wrambank(bank); }
 
-uint8_t Memory::read8(uint16_t address)
+void Memory::remap(const range_t range)
+{
+    for (unsigned page = range.first >> 8; page <= unsigned(range.second >> 8); page++)
+    {
+        // Video RAM is locked and unlocked twice every scanline
+        if (this->is_within(page << 8, VideoRAM))
+        {
+            this->map_video();
+            page = VideoRAM.second >> 8;
+            continue;
+        }
+        this->map_page(page);
+        // echo RAM follows work RAM
+        if (page >= 0xC0 && page < 0xDE) this->map_page(page + 0x20);
+    }
+}
+
+void Memory::map_video()
+{
+    const uint8_t** rpages = &m_read_pages[VideoRAM.first >> 8];
+    uint8_t** wpages = &m_write_pages[VideoRAM.first >> 8];
+    const unsigned count = range_size(VideoRAM) / 0x100 + 1;
+    // cant access Video RAM when working on scanline
+    if (machine().gpu.get_mode() == 3)
+    {
+        std::fill_n(rpages, count, nullptr);
+        std::fill_n(wpages, count, nullptr);
+        return;
+    }
+    const uint16_t offset = machine().gpu.video_offset();
+    const uint8_t* rvram = m_video_ram.page(offset / m_video_ram.PAGE_SIZE);
+    for (unsigned i = 0; i < count; i++)
+    {
+        rpages[i] = rvram + i * 0x100;
+        // writes go through write_slow() until they are tracked in this epoch,
+        // and always for tile patterns, which the GPU keeps decoded
+        if (VideoRAM.first + i * 0x100 > TilePatterns.second)
+            wpages[i] = m_video_ram.write_pointer(offset + i * 0x100);
+        else
+            wpages[i] = nullptr;
+    }
+    if (UNLIKELY(this->has_read_breakpoints())) std::fill_n(rpages, count, nullptr);
+    if (UNLIKELY(this->has_write_breakpoints())) std::fill_n(wpages, count, nullptr);
+    if (UNLIKELY(this->has_watchpoints()))
+    {
+        for (unsigned i = 0; i < count; i++)
+        {
+            const uint16_t address = VideoRAM.first + i * 0x100;
+            if (this->watched_page(READ, address)) rpages[i] = nullptr;
+            if (this->watched_page(WRITE, address)) wpages[i] = nullptr;
+        }
+    }
+}
+
+void Memory::map_page(const uint8_t page)
+{
+    const uint16_t address = page << 8;
+    const uint8_t* rpage = nullptr;
+    uint8_t* wpage = nullptr;
+    switch (address & 0xF000)
+    {
+    case 0x0000:
+    case 0x1000:
+    case 0x2000:
+    case 0x3000:
+        // writes go to the MBC
+        if (address + 0x100u <= rom_size()) rpage = m_mbc.rombank0() + address;
+        break;
+    case 0x4000:
+    case 0x5000:
+    case 0x6000:
+    case 0x7000:
+    {
+        const size_t offset = m_mbc.rombank_offset() | (address - 0x4000);
+        if (offset + 0x100 <= rom_size()) rpage = m_mbc.rombankx() + (address - 0x4000);
+        break;
+    }
+    case 0xF000:
+        if (this->is_within(address, OAM_RAM))
+        {
+            // writes go through write_slow, so the GPU can see OAM changes
+            if (!machine().io.dma_active()) rpage = m_state.oam_ram.data();
+            break;
+        }
+        else if (!this->is_within(address, EchoRAM))
+        {
+            break; // I/O ports and ZRAM share a page
+        }
+        [[fallthrough]];
+    default: // cartridge RAM, work RAM and echo RAM
+        rpage = m_mbc.read_page(address);
+        wpage = m_mbc.write_page(address);
+        // writes must invalidate code cached from work RAM
+        if (address >= WorkRAM.first)
+        {
+            const uint8_t wram_page = (address <= WorkRAM.second) ? page : page - 0x20;
+            if (machine().cpu.block_cache().code_page(wram_page)) wpage = nullptr;
+        }
+        break;
+    }
+    if (UNLIKELY(this->has_read_breakpoints() || this->watched_page(READ, address)))
+        rpage = nullptr;
+    if (UNLIKELY(this->has_write_breakpoints() || this->watched_page(WRITE, address)))
+        wpage = nullptr;
+    this->m_read_pages[page] = rpage;
+    this->m_write_pages[page] = wpage;
+}
+
+uint8_t Memory::read_slow(uint16_t address)
 {
     if (UNLIKELY(!m_read_breakpoints.empty() && !m_is_busy))
     {
@@ -32,26 +145,33 @@ uint8_t Memory::read8(uint16_t address)
         for (auto& func : m_read_breakpoints) { func(*this, address, 0x0); }
         this->m_is_busy = false;
     }
+    const uint8_t value = this->read_device(address);
+    if (UNLIKELY(this->is_watched(READ, address))) this->watch_triggered(READ, address, value);
+    return value;
+}
+
+uint8_t Memory::read_device(uint16_t address)
+{
     switch (address & 0xF000)
     {
     case 0x0000:
     case 0x1000:
     case 0x2000:
     case 0x3000:
-        return m_rom[address];
+        return m_mbc.rombank0()[address];
     case 0x4000:
     case 0x5000:
     case 0x6000:
     case 0x7000:
         address -= 0x4000;
-        return m_rom[m_mbc.rombank_offset() | address];
+        return m_mbc.rombankx()[address];
     case 0x8000:
     case 0x9000:
         // cant read from Video RAM when working on scanline
         if (UNLIKELY(machine().gpu.get_mode() != 3))
         {
             const uint16_t offset = machine().gpu.video_offset();
-            return m_state.video_ram.at(offset + address - VideoRAM.first);
+            return m_video_ram.read(offset + address - VideoRAM.first);
         }
         return 0xff;
     case 0xA000:
@@ -87,7 +207,7 @@ uint8_t Memory::read8(uint16_t address)
     return 0xff;
 }
 
-void Memory::write8(uint16_t address, uint8_t value)
+void Memory::write_slow(uint16_t address, uint8_t value)
 {
     if (UNLIKELY(!m_write_breakpoints.empty() && !m_is_busy))
     {
@@ -95,6 +215,29 @@ void Memory::write8(uint16_t address, uint8_t value)
         for (auto& func : m_write_breakpoints) { func(*this, address, value); }
         this->m_is_busy = false;
     }
+    if (UNLIKELY(this->is_watched(WRITE, address))) this->watch_triggered(WRITE, address, value);
+    // a write that allocates a RAM page, or copies it away from a forked
+    // machine, moves all the memory pages within it
+    bool copied = false;
+    if (this->is_within(address, VideoRAM))
+        copied = m_video_ram.shared(machine().gpu.video_offset() / m_video_ram.PAGE_SIZE);
+    else if (address >= BankRAM.first && address < OAM_RAM.first)
+        copied = m_mbc.page_shared(address);
+    this->write_device(address, value);
+    if (copied)
+    {
+        // echo RAM is remapped along with work RAM
+        const uint16_t first = (address & 0xF000) - (address >= EchoRAM.first ? 0x2000 : 0);
+        this->remap({first, uint16_t(first + 0xFFF)});
+    }
+    // otherwise only blocks written in this epoch become writable directly,
+    // and never tile patterns, which the GPU keeps decoded
+    else if (address > TilePatterns.second && address < OAM_RAM.first)
+        this->remap({address, address});
+}
+
+void Memory::write_device(uint16_t address, uint8_t value)
+{
     switch (address & 0xF000)
     {
     case 0x0000:
@@ -111,8 +254,9 @@ void Memory::write8(uint16_t address, uint8_t value)
     case 0x9000:
         if (machine().gpu.get_mode() != 3)
         {
-            const uint16_t offset = machine().gpu.video_offset();
-            m_state.video_ram.at(offset + address - VideoRAM.first) = value;
+            const uint16_t offset = machine().gpu.video_offset() + address - VideoRAM.first;
+            m_video_ram.write(offset, value);
+            machine().gpu.video_written(offset);
         }
         return;
     case 0xA000:
@@ -122,19 +266,23 @@ void Memory::write8(uint16_t address, uint8_t value)
     case 0xC000:
     case 0xD000:
         m_mbc.write(address, value);
+        machine().cpu.block_cache().ram_written(address);
         return;
     case 0xE000: // echo RAM
         m_mbc.write(address, value);
+        machine().cpu.block_cache().ram_written(address - 0x2000);
         return;
     case 0xF000:
         if (this->is_within(address, EchoRAM))
         {
             m_mbc.write(address, value);
+            machine().cpu.block_cache().ram_written(address - 0x2000);
             return;
         }
         else if (this->is_within(address, OAM_RAM))
         {
             this->m_state.oam_ram.at(address - OAM_RAM.first) = value;
+            machine().gpu.oam_changed();
             return;
         }
         else if (this->is_within(address, IO_Ports))
@@ -145,6 +293,7 @@ void Memory::write8(uint16_t address, uint8_t value)
         else if (this->is_within(address, ZRAM))
         {
             this->m_state.zram.at(address - ZRAM.first) = value;
+            machine().cpu.block_cache().ram_written(address);
             return;
         }
         else if (address == InterruptEn)
@@ -156,9 +305,42 @@ void Memory::write8(uint16_t address, uint8_t value)
     printf(">>> Invalid memory write at 0x%04x, value 0x%x\n", address, value);
 }
 
+void Memory::watchpoint(amode_t mode, uint16_t address, access_t func, int value)
+{
+    const int16_t cond = (value < 0) ? -1 : (value & 0xFF);
+    this->m_watchpoints[mode].push_back({address, cond, std::move(func)});
+    if (m_watched.empty()) m_watched.resize(2);
+    this->m_watched[mode][address >> 6] |= 1ull << (address & 63);
+    // accesses to the page now have to take the slow path
+    this->remap({address, address});
+    // and opcodes can't be fetched from decoded blocks there
+    if (mode == READ) machine().cpu.block_cache().flush();
+}
+void Memory::clear_watchpoints()
+{
+    for (auto& list : m_watchpoints) list.clear();
+    this->m_watched = {};
+    this->remap();
+}
+void Memory::watch_triggered(const amode_t mode, const uint16_t address, const uint8_t value)
+{
+    if (this->m_is_busy) return;
+    this->m_is_busy = true;
+    for (auto& wp : m_watchpoints[mode])
+    {
+        if (wp.address == address && (wp.value < 0 || wp.value == value))
+            wp.func(*this, address, value);
+    }
+    this->m_is_busy = false;
+}
+
 void Memory::do_switch_speed()
 {
     auto& reg = machine().io.reg(IO::REG_KEY1);
+    // GPU timings depend on the speed factor, and so does the clock
+    machine().gpu.sync();
+    this->m_mbc.rtc_update();
+    const int old_factor = this->speed_factor();
     if (this->double_speed())
     {
         this->m_state.speed_factor = 1;
@@ -169,6 +351,8 @@ void Memory::do_switch_speed()
         this->m_state.speed_factor = 2;
         reg = 0x80;
     }
+    this->m_mbc.rtc_speed_changed(old_factor);
+    machine().gpu.reschedule();
 }
 
 std::string Memory::explain(const uint16_t addr) const
@@ -208,18 +392,54 @@ std::string Memory::explain(const uint16_t addr) const
     return "Unknown";
 }
 
+void Memory::fork_from(const Memory& other)
+{
+    this->m_state = other.m_state;
+    this->m_video_ram = other.m_video_ram;
+    this->m_mbc.fork_from(other.m_mbc);
+    machine().gpu.memory_replaced();
+}
+
 // serialization
 int Memory::restore_state(const std::vector<uint8_t>& data, int off)
 {
     this->m_state = *(state_t*) &data.at(off);
     off += sizeof(state_t);
+    machine().gpu.memory_replaced();
+    this->m_video_ram.restore(&data.at(off), 0, m_video_ram.SIZE);
+    off += m_video_ram.SIZE;
     // also restore MBC
-    return sizeof(state_t) + this->m_mbc.restore_state(data, off);
+    return sizeof(state_t) + m_video_ram.SIZE + this->m_mbc.restore_state(data, off);
 }
 void Memory::serialize_state(std::vector<uint8_t>& res) const
 {
     res.insert(res.end(), (uint8_t*) &m_state, (uint8_t*) &m_state + sizeof(m_state));
+    this->m_video_ram.serialize(res, 0, m_video_ram.SIZE);
     // also serialize MBC
     this->m_mbc.serialize_state(res);
 }
+
+uint32_t Memory::new_epoch()
+{
+    this->m_video_ram.next_epoch();
+    const uint32_t epoch = this->m_mbc.next_epoch();
+    // the next write to each page has to be recorded again
+    this->remap();
+    return epoch;
+}
+int Memory::restore_changes(const std::vector<uint8_t>& data, int off)
+{
+    this->m_state = *(state_t*) &data.at(off);
+    off += sizeof(state_t);
+    machine().gpu.memory_replaced();
+    const int vram = this->m_video_ram.restore_changes(data, off);
+    return sizeof(state_t) + vram + this->m_mbc.restore_changes(data, off + vram);
+}
+void Memory::serialize_changes(std::vector<uint8_t>& res, uint32_t epoch) const
+{
+    // OAM and high RAM are small enough to always include
+    res.insert(res.end(), (uint8_t*) &m_state, (uint8_t*) &m_state + sizeof(m_state));
+    this->m_video_ram.serialize_changes(res, epoch);
+    this->m_mbc.serialize_changes(res, epoch);
+}
 } // namespace gbc
@@ -15,6 +15,7 @@ public:
     using range_t = std::pair<uint16_t, uint16_t>;
     static constexpr range_t ProgramArea{0x0000, 0x7FFF};
     static constexpr range_t VideoRAM{0x8000, 0x9FFF};
+    static constexpr range_t TilePatterns{0x8000, 0x97FF}; // the rest is tile maps
 
     static constexpr range_t BankRAM{0xA000, 0xBFFF};
     static constexpr range_t WorkRAM{0xC000, 0xDFFF};
@@ -25,9 +26,12 @@ public:
     static constexpr range_t ZRAM{0xFF80, 0xFFFE};
     static constexpr uint16_t InterruptEn = 0xFFFF;
 
-    Memory(Machine&, const std::string_view rom);
+    Memory(Machine&, const Rom& rom);
     void reset();
     void set_wram_bank(uint8_t bank);
+    // rebuild the direct page pointers covering @range, after a bank switch
+    // or a change in what the CPU is allowed to access there
+    void remap(range_t range = {0x0000, 0xFFFF});
 
     uint8_t read8(uint16_t address);
     void write8(uint16_t address, uint8_t value);
@@ -37,13 +41,15 @@ public:
 
     uint8_t* oam_ram_ptr() noexcept { return m_state.oam_ram.data(); }
     const uint8_t* oam_ram_ptr() const noexcept { return m_state.oam_ram.data(); }
-    uint8_t* video_ram_ptr() noexcept { return m_state.video_ram.data(); }
-    const uint8_t* video_ram_ptr() const noexcept { return m_state.video_ram.data(); }
+    const uint8_t* video_bank_ptr(int bank) const noexcept { return m_video_ram.page(bank); }
 
     static constexpr uint16_t range_size(range_t range) { return range.second - range.first; }
 
     Machine& machine() const noexcept { return m_machine; }
     Machine& machine() noexcept { return m_machine; }
+    const MBC& mbc() const noexcept { return m_mbc; }
+    MBC& mbc() noexcept { return m_mbc; }
+    size_t rom_size() const noexcept { return m_mbc.rom().size(); }
     bool rom_valid() const noexcept;
     bool bootrom_enabled() const noexcept { return false; }
     void disable_bootrom();
@@ -52,9 +58,19 @@ public:
     int speed_factor() const noexcept { return m_state.speed_factor; }
     void do_switch_speed();
 
+    // become a copy of @other, sharing its RAM pages copy-on-write
+    void fork_from(const Memory& other);
+    // bytes of RAM allocated outside of the machine itself
+    size_t footprint() const noexcept { return m_video_ram.footprint() + m_mbc.footprint(); }
+
     // serialization
     int restore_state(const std::vector<uint8_t>&, int);
     void serialize_state(std::vector<uint8_t>&) const;
+    // start a new epoch of change tracking, returning its number
+    uint32_t new_epoch();
+    // serialization of only the RAM written since the start of @epoch
+    int restore_changes(const std::vector<uint8_t>&, int);
+    void serialize_changes(std::vector<uint8_t>&, uint32_t epoch) const;
 
     // debugging
     std::string explain(uint16_t address) const;
@@ -65,6 +81,34 @@ public:
     };
     using access_t = std::function<void(Memory&, uint16_t, uint8_t)>;
     void breakpoint(amode_t, access_t);
+    bool has_read_breakpoints() const noexcept { return !m_read_breakpoints.empty(); }
+    bool has_write_breakpoints() const noexcept { return !m_write_breakpoints.empty(); }
+    // call @func only on accesses to @address, after reads and before writes,
+    // and only when the value is @value, unless it is negative
+    void watchpoint(amode_t, uint16_t address, access_t func, int value = -1);
+    void clear_watchpoints();
+    bool has_watchpoints() const noexcept
+    {
+        return !m_watchpoints[READ].empty() || !m_watchpoints[WRITE].empty();
+    }
+    bool is_watched(amode_t mode, uint16_t address) const noexcept
+    {
+        if (m_watched.empty()) return false;
+        return (m_watched[mode][address >> 6] >> (address & 63)) & 1;
+    }
+    // true when any address in the 256-byte page of @address is watched
+    bool watched_page(amode_t mode, uint16_t address) const noexcept
+    {
+        if (m_watched.empty()) return false;
+        const uint64_t* bits = &m_watched[mode][(address >> 8) * 4];
+        return (bits[0] | bits[1] | bits[2] | bits[3]) != 0;
+    }
+    // true when accesses to the page of @address bypass the slow path
+    bool fast_page(amode_t mode, uint16_t address) const noexcept
+    {
+        if (mode == READ) return m_read_pages[address >> 8] != nullptr;
+        return m_write_pages[address >> 8] != nullptr;
+    }
 
     inline static bool is_within(uint16_t addr, const range_t& range)
     {
@@ -72,20 +116,41 @@ public:
     }
 
 private:
+    void map_page(uint8_t page);
+    void map_video();
+    uint8_t read_slow(uint16_t address);
+    void write_slow(uint16_t address, uint8_t value);
+    uint8_t read_device(uint16_t address);
+    void write_device(uint16_t address, uint8_t value);
+    void watch_triggered(amode_t, uint16_t address, uint8_t value);
+
     Machine& m_machine;
-    const std::string_view m_rom;
     MBC m_mbc;
+    // one page per bank, so that bank 1 is only allocated when CGB games use it
+    SharedPages<0x2000, 2> m_video_ram;
     struct state_t
     {
-        std::array<uint8_t, 16384> video_ram = {};
         std::array<uint8_t, 256> oam_ram = {};
         std::array<uint8_t, 128> zram = {}; // high-speed RAM
         bool bootrom_enabled = true;
         int8_t speed_factor = 1;
     } m_state;
     bool m_is_busy = false;
+    // direct pointers to each 256-byte page, or nullptr where accesses have
+    // side effects or depend on hardware state, and must take the slow path
+    std::array<const uint8_t*, 256> m_read_pages = {};
+    std::array<uint8_t*, 256> m_write_pages = {};
     std::vector<access_t> m_read_breakpoints;
     std::vector<access_t> m_write_breakpoints;
+    struct watch_t
+    {
+        uint16_t address;
+        int16_t value; // or -1 for any value
+        access_t func;
+    };
+    std::array<std::vector<watch_t>, 2> m_watchpoints;
+    // one bit for each watched address, per access mode, once there are any
+    std::vector<std::array<uint64_t, 1024>> m_watched;
 };
 
 inline void Memory::breakpoint(amode_t mode, access_t func)
@@ -94,6 +159,25 @@ inline void Memory::breakpoint(amode_t mode, access_t func)
         m_read_breakpoints.push_back(func);
     else if (mode == WRITE)
         m_write_breakpoints.push_back(func);
+    // every access has to go through the breakpoints now
+    this->remap();
+}
+
+inline uint8_t Memory::read8(uint16_t address)
+{
+    const uint8_t* page = m_read_pages[address >> 8];
+    if (LIKELY(page != nullptr)) return page[address & 0xFF];
+    return this->read_slow(address);
+}
+inline void Memory::write8(uint16_t address, uint8_t value)
+{
+    uint8_t* page = m_write_pages[address >> 8];
+    if (LIKELY(page != nullptr))
+    {
+        page[address & 0xFF] = value;
+        return;
+    }
+    this->write_slow(address, value);
 }
 
 inline uint16_t Memory::read16(uint16_t address)
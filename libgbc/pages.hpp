@@ -0,0 +1,176 @@
+#pragma once
+#include "common.hpp"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace gbc
+{
+// RAM split into fixed-size pages that can be shared copy-on-write between
+// machines: copying a SharedPages shares every page, and a shared page is
+// only copied when one of the owners writes to it. Pages are allocated on
+// the first write, and read as zeroes until then.
+// Writes are also tracked in 256-byte blocks, by the epoch they happened in,
+// so that only the blocks changed since a given epoch need serializing.
+template <size_t PageSize, size_t Pages>
+class SharedPages
+{
+public:
+    static constexpr size_t PAGE_SIZE = PageSize;
+    static constexpr size_t PAGES = Pages;
+    static constexpr size_t SIZE = PageSize * Pages;
+    static constexpr size_t BLOCK_SIZE = 0x100;
+    static constexpr size_t BLOCKS = SIZE / BLOCK_SIZE;
+    using page_t = std::array<uint8_t, PageSize>;
+    static_assert(PageSize % BLOCK_SIZE == 0, "Pages must be whole blocks");
+
+    const uint8_t* page(size_t n) const noexcept
+    {
+        return m_pages[n] ? m_pages[n]->data() : zero_page().data();
+    }
+    // true when writing to page @n has to allocate or copy it first
+    bool shared(size_t n) const noexcept { return m_pages[n].use_count() != 1; }
+    // bytes allocated for pages, counting pages shared between forked
+    // machines in equal parts
+    size_t footprint() const noexcept
+    {
+        size_t bytes = 0;
+        for (const auto& page : m_pages)
+            if (page) bytes += PageSize / page.use_count();
+        return bytes;
+    }
+
+    uint8_t read(size_t offset) const noexcept
+    {
+        return this->page(offset / PageSize)[offset % PageSize];
+    }
+    void write(size_t offset, uint8_t value)
+    {
+        this->writable(offset)[offset % BLOCK_SIZE] = value;
+    }
+    // the block at @offset, for writing straight into, or nullptr until
+    // write() has copied its page and recorded it as changed in this epoch
+    uint8_t* write_pointer(size_t offset) noexcept
+    {
+        const size_t n = offset / PageSize;
+        if (shared(n) || m_written[offset / BLOCK_SIZE] != m_epoch) return nullptr;
+        return m_pages[n]->data() + offset % PageSize;
+    }
+
+    // back page @n with memory kept alive by @owner, such as a mapped file
+    void attach(size_t n, page_t* page, std::shared_ptr<void> owner)
+    {
+        m_pages[n] = std::shared_ptr<page_t>(page, [owner](page_t*) {});
+        std::fill_n(&m_written[n * PageSize / BLOCK_SIZE], PageSize / BLOCK_SIZE, m_epoch);
+    }
+    // give page @n a private copy, if it has been allocated
+    void detach(size_t n)
+    {
+        if (m_pages[n] != nullptr) m_pages[n] = std::make_shared<page_t>(*m_pages[n]);
+    }
+
+    uint32_t epoch() const noexcept { return m_epoch; }
+    // start a new epoch, after which every block needs a write() again
+    // before write_pointer() hands it out
+    uint32_t next_epoch() noexcept { return ++m_epoch; }
+    bool changed_since(size_t block, uint32_t epoch) const noexcept
+    {
+        return m_written[block] >= epoch;
+    }
+
+    // serialization of @bytes starting at @offset
+    void serialize(std::vector<uint8_t>& res, size_t offset, size_t bytes) const
+    {
+        while (bytes > 0)
+        {
+            const size_t len = std::min(bytes, PageSize - offset % PageSize);
+            const uint8_t* src = this->page(offset / PageSize) + offset % PageSize;
+            res.insert(res.end(), src, src + len);
+            offset += len;
+            bytes -= len;
+        }
+    }
+    void restore(const uint8_t* data, size_t offset, size_t bytes)
+    {
+        while (bytes > 0)
+        {
+            const size_t len = std::min(bytes, BLOCK_SIZE - offset % BLOCK_SIZE);
+            const bool zeroes = std::all_of(data, data + len, [](uint8_t b) { return b == 0; });
+            // restoring zeroes into a page that was never written allocates nothing
+            if (m_pages[offset / PageSize] != nullptr || !zeroes)
+                std::copy(data, data + len, this->writable(offset) + offset % BLOCK_SIZE);
+            else
+                m_written[offset / BLOCK_SIZE] = m_epoch;
+            data += len;
+            offset += len;
+            bytes -= len;
+        }
+    }
+    // serialization of only the blocks changed since the start of @epoch:
+    // the number of blocks, followed by the index and contents of each
+    void serialize_changes(std::vector<uint8_t>& res, uint32_t epoch) const
+    {
+        const size_t count_offset = res.size();
+        uint16_t count = 0;
+        res.resize(res.size() + sizeof(count));
+        for (size_t block = 0; block < BLOCKS; block++)
+        {
+            if (!this->changed_since(block, epoch)) continue;
+            const uint16_t index = block;
+            res.insert(res.end(), (const uint8_t*) &index, (const uint8_t*) &index + 2);
+            this->serialize(res, block * BLOCK_SIZE, BLOCK_SIZE);
+            count++;
+        }
+        std::copy((const uint8_t*) &count, (const uint8_t*) &count + 2, &res[count_offset]);
+    }
+    // returns the number of bytes consumed from @data at @off
+    size_t restore_changes(const std::vector<uint8_t>& data, size_t off)
+    {
+        const size_t start = off;
+        uint16_t count;
+        if (off + sizeof(count) > data.size())
+            throw MachineException("Truncated block count in serialized changes");
+        std::copy(&data[off], &data[off] + 2, (uint8_t*) &count);
+        off += sizeof(count);
+        for (unsigned i = 0; i < count; i++)
+        {
+            if (off + 2 + BLOCK_SIZE > data.size())
+                throw MachineException("Truncated block in serialized changes");
+            uint16_t index;
+            std::copy(&data[off], &data[off] + 2, (uint8_t*) &index);
+            if (index >= BLOCKS) throw MachineException("Invalid block in serialized changes");
+            this->restore(&data[off + 2], index * BLOCK_SIZE, BLOCK_SIZE);
+            off += 2 + BLOCK_SIZE;
+        }
+        return off - start;
+    }
+
+private:
+    // the block at @offset, after copying its page if another machine can
+    // see it, and recording the write in this epoch
+    uint8_t* writable(size_t offset)
+    {
+        auto& page = m_pages[offset / PageSize];
+        if (UNLIKELY(page == nullptr))
+            page = std::make_shared<page_t>();
+        else if (UNLIKELY(page.use_count() > 1))
+            page = std::make_shared<page_t>(*page);
+        m_written[offset / BLOCK_SIZE] = m_epoch;
+        return page->data() + (offset % PageSize) / BLOCK_SIZE * BLOCK_SIZE;
+    }
+
+    static const page_t& zero_page() noexcept
+    {
+        static const page_t zeroes = {};
+        return zeroes;
+    }
+
+    std::array<std::shared_ptr<page_t>, Pages> m_pages;
+    // the last epoch each block was written in
+    std::array<uint32_t, BLOCKS> m_written = {};
+    uint32_t m_epoch = 0;
+};
+} // namespace gbc
@@ -1,5 +1,6 @@
 #pragma once
 #include "common.hpp"
+#include <array>
 #include <string>
 #include <stdexcept>
 
@@ -12,6 +13,8 @@ enum flags_t
     MASK_HALFCARRY = 0x20,
     MASK_CARRY = 0x10,
 };
+// flags of ADD and SUB/CP for every accumulator and operand, see alu.hpp
+extern const std::array<uint8_t, 2 * 256 * 256> ALU_FLAGS;
 
 struct regs_t
 {
@@ -55,6 +58,13 @@ struct regs_t
     uint16_t sp;
     uint16_t pc;
 
+    // ADD, SUB, AND, XOR, OR and CP only record their operands, and the
+    // flags are computed when something reads them, see resolve_flags()
+    static constexpr uint8_t FLAGS_RESOLVED = 0xFF;
+    uint8_t lazy_op = FLAGS_RESOLVED;
+    uint8_t lazy_accum = 0;
+    uint8_t lazy_value = 0;
+
     inline uint16_t& getreg(const uint8_t bf, const bool use_sp)
     {
         switch (bf & 0x3)
@@ -97,8 +107,41 @@ struct regs_t
         __builtin_unreachable();
     }
 
+    // the flags register, including any flags that are still pending
+    uint8_t current_flags() const noexcept
+    {
+        if (LIKELY(lazy_op == FLAGS_RESOLVED)) return flags;
+        const uint8_t a = lazy_accum;
+        const uint8_t v = lazy_value;
+        switch (lazy_op)
+        {
+        case 0x0: // ADD
+            return (flags & 0x0F) | ALU_FLAGS[(a << 8) | v];
+        case 0x2: // SUB
+        case 0x7: // CP
+            return (flags & 0x0F) | ALU_FLAGS[0x10000 | (a << 8) | v];
+        case 0x4: // AND
+            return MASK_HALFCARRY | ((a & v) == 0 ? MASK_ZERO : 0);
+        case 0x5: // XOR
+            return (a ^ v) == 0 ? MASK_ZERO : 0;
+        case 0x6: // OR
+            return (a | v) == 0 ? MASK_ZERO : 0;
+        }
+        __builtin_unreachable();
+    }
+    // compute pending flags, before reading or partially updating them
+    void resolve_flags() noexcept
+    {
+        if (UNLIKELY(lazy_op != FLAGS_RESOLVED))
+        {
+            this->flags = current_flags();
+            this->lazy_op = FLAGS_RESOLVED;
+        }
+    }
+
     bool compare_flags(const uint8_t opcode) noexcept
     {
+        this->resolve_flags();
         const uint8_t idx = (opcode >> 3) & 0x3;
         if (idx == 0) return (flags & MASK_ZERO) == 0;  // not zero
         if (idx == 1) return (flags & MASK_ZERO);       // zero
@@ -121,18 +164,9 @@ struct regs_t
         auto& reg = this->accum;
         switch (op & 0x7)
         {
-        case 0x0:
-        { // ADD
-            const uint16_t calc = reg + value;
-            setflag(false, flags, MASK_NEGATIVE);
-            setflag(half_carry(reg, value), flags, MASK_HALFCARRY);
-            setflag(calc & 0x100, flags, MASK_CARRY);
-            reg += value;
-            setflag(reg == 0, flags, MASK_ZERO);
-        }
-            return;
         case 0x1:
         { // ADC
+            this->resolve_flags();
             const int carry = (flags & MASK_CARRY) ? 1 : 0;
             setflag(false, flags, MASK_NEGATIVE);
             setflag((reg & 0xf) + (value & 0xf) + carry > 0xf, flags, MASK_HALFCARRY); // annoying!
@@ -141,15 +175,9 @@ struct regs_t
             setflag(reg == 0, flags, MASK_ZERO);
         }
             return;
-        case 0x2: // SUB
-            setflag(true, flags, MASK_NEGATIVE);
-            setflag(half_borrow(reg, value), flags, MASK_HALFCARRY);
-            setflag(reg < value, flags, MASK_CARRY);
-            setflag(reg == value, flags, MASK_ZERO);
-            reg -= value;
-            return;
         case 0x3:
         { // SBC
+            this->resolve_flags();
             const int carry = (flags & MASK_CARRY) ? 1 : 0;
             flags = MASK_NEGATIVE;
             setflag(((reg & 0xf) - (value & 0xf) - carry) < 0, flags, MASK_HALFCARRY);
@@ -158,28 +186,27 @@ struct regs_t
             setflag(reg == 0, flags, MASK_ZERO);
         }
             return;
+        }
+        // the flags of any previous operation are overwritten unread
+        this->lazy_op = op & 0x7;
+        this->lazy_accum = reg;
+        this->lazy_value = value;
+        switch (op & 0x7)
+        {
+        case 0x0: // ADD
+            reg += value;
+            return;
+        case 0x2: // SUB
+            reg -= value;
+            return;
         case 0x4: // AND
             reg &= value;
-            flags = MASK_HALFCARRY;
-            setflag(reg == 0, flags, MASK_ZERO);
             return;
         case 0x5: // XOR
             reg ^= value;
-            flags = 0;
-            setflag(reg == 0, flags, MASK_ZERO);
             return;
         case 0x6: // OR
             reg |= value;
-            flags = 0;
-            setflag(reg == 0, flags, MASK_ZERO);
-            return;
-        case 0x7: // CP
-            const uint8_t tmp = reg - value;
-            flags |= MASK_NEGATIVE;
-            setflag(tmp == 0, flags, MASK_ZERO);
-            setflag(reg < value, flags, MASK_CARRY);
-            setflag(half_borrow(reg, value), flags, MASK_HALFCARRY);
-            // printf("CP %02x vs %02x (F => %02x)\n", reg, value, flags);
             return;
         }
     } // alu()
@@ -190,7 +217,7 @@ struct regs_t
         int len = snprintf(buffer, sizeof(buffer),
                            "\tAF = %04X  BC = %04X  DE = %04X\n"
                            "\tHL = %04X  SP = %04X  PC = %04X\n",
-                           af, bc, de, hl, sp, pc);
+                           (accum << 8) | current_flags(), bc, de, hl, sp, pc);
         return std::string(buffer, len);
     }
 };
@@ -0,0 +1,283 @@
+#include "rom.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#ifdef __unix__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace gbc
+{
+// compressed images: the magic, the number of banks and the compressed size
+// of each bank, all 32-bit little-endian, followed by the banks themselves.
+// Banks are LZ4 blocks, or stored as they are when that is not smaller.
+static const char COMPRESSED_MAGIC[4] = {'G', 'B', 'Z', '1'};
+
+static uint32_t read32(const uint8_t* p) noexcept
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | uint32_t(p[3]) << 24;
+}
+static void write32(std::vector<uint8_t>& out, uint32_t value)
+{
+    for (int i = 0; i < 4; i++) out.push_back(value >> (i * 8));
+}
+static bool is_compressed(const uint8_t* data, size_t size) noexcept
+{
+    return size >= 8 && std::memcmp(data, COMPRESSED_MAGIC, 4) == 0;
+}
+
+// decode one LZ4 block into exactly @cap bytes, rejecting anything malformed
+static bool lz_decode(const uint8_t* src, size_t len, uint8_t* dst, size_t cap) noexcept
+{
+    const uint8_t* end = src + len;
+    size_t out = 0;
+    const auto length = [&](size_t& n) {
+        uint8_t b;
+        do
+        {
+            if (src >= end) return false;
+            b = *src++;
+            n += b;
+        } while (b == 255);
+        return true;
+    };
+    while (src < end)
+    {
+        const uint8_t token = *src++;
+        size_t literals = token >> 4;
+        if (literals == 15 && !length(literals)) return false;
+        if (literals > size_t(end - src) || literals > cap - out) return false;
+        std::copy_n(src, literals, dst + out);
+        src += literals;
+        out += literals;
+        // the last sequence has no match
+        if (src == end) break;
+        if (end - src < 2) return false;
+        const size_t offset = src[0] | src[1] << 8;
+        src += 2;
+        size_t match = token & 0xF;
+        if (match == 15 && !length(match)) return false;
+        match += 4;
+        if (offset == 0 || offset > out || match > cap - out) return false;
+        // matches can overlap what they produce
+        for (size_t i = 0; i < match; i++, out++) dst[out] = dst[out - offset];
+    }
+    return out == cap;
+}
+
+static void lz_length(std::vector<uint8_t>& out, size_t n)
+{
+    for (; n >= 255; n -= 255) out.push_back(255);
+    out.push_back(n);
+}
+// greedy LZ4 block compression, following the end-of-block rules of the format
+static std::vector<uint8_t> lz_encode(const uint8_t* src, size_t len)
+{
+    std::vector<uint8_t> out;
+    std::array<int32_t, 4096> table;
+    table.fill(-1);
+    size_t anchor = 0;
+    size_t pos = 0;
+    // matches start at least 12 bytes, and end at least 5 bytes, before the end
+    const size_t limit = (len > 12) ? len - 12 : 0;
+    while (pos < limit)
+    {
+        uint32_t sequence;
+        std::memcpy(&sequence, src + pos, 4);
+        const uint32_t hash = (sequence * 2654435761u) >> 20;
+        const int32_t candidate = table[hash];
+        table[hash] = pos;
+        if (candidate < 0 || pos - candidate > 0xFFFF ||
+            std::memcmp(src + candidate, src + pos, 4) != 0)
+        {
+            pos++;
+            continue;
+        }
+        size_t match = 4;
+        while (pos + match < len - 5 && src[candidate + match] == src[pos + match]) match++;
+
+        const size_t literals = pos - anchor;
+        out.push_back(std::min<size_t>(literals, 15) << 4 | std::min<size_t>(match - 4, 15));
+        if (literals >= 15) lz_length(out, literals - 15);
+        out.insert(out.end(), src + anchor, src + pos);
+        const size_t offset = pos - candidate;
+        out.push_back(offset & 0xFF);
+        out.push_back(offset >> 8);
+        if (match - 4 >= 15) lz_length(out, match - 4 - 15);
+        pos += match;
+        anchor = pos;
+    }
+    const size_t literals = len - anchor;
+    out.push_back(std::min<size_t>(literals, 15) << 4);
+    if (literals >= 15) lz_length(out, literals - 15);
+    out.insert(out.end(), src + anchor, src + len);
+    return out;
+}
+
+Rom::Rom(const uint8_t* data, size_t size, bool mapped)
+    : m_data(data), m_size(size), m_mapped(mapped), m_header(data)
+{}
+Rom::~Rom()
+{
+#ifdef __unix__
+    if (this->m_mapped) munmap((void*) m_data, m_size);
+#endif
+}
+
+void Rom::index()
+{
+    if (is_compressed(m_data, m_size))
+    {
+        this->parse_compressed();
+        return;
+    }
+    for (size_t offset = 0; offset < m_size; offset += BANK_SIZE)
+    {
+        this->m_banks.push_back(m_data + offset);
+        this->m_bank_sizes.push_back(std::min(BANK_SIZE, m_size - offset));
+    }
+}
+void Rom::parse_compressed()
+{
+    const size_t banks = read32(m_data + 4);
+    // at most 8MB, which is as big as cartridges get
+    if (banks == 0 || banks > 512 || m_size < 8 + 4 * banks)
+        throw MachineException("Rom: Invalid compressed image");
+    const uint8_t* bank = m_data + 8 + 4 * banks;
+    for (size_t n = 0; n < banks; n++)
+    {
+        const uint32_t size = read32(m_data + 8 + 4 * n);
+        if (size > BANK_SIZE || size_t(m_data + m_size - bank) < size)
+            throw MachineException("Rom: Invalid compressed image");
+        this->m_banks.push_back(bank);
+        this->m_bank_sizes.push_back(size);
+        bank += size;
+    }
+    this->m_compressed = true;
+    // keep the header around, as bank 0 lives in the machines
+    bank_t bank0;
+    this->decompress(0, bank0);
+    std::copy_n(bank0.begin(), m_header_copy.size(), m_header_copy.begin());
+    this->m_header = m_header_copy.data();
+}
+
+void Rom::decompress(size_t n, bank_t& dst) const
+{
+    n %= m_banks.size();
+    const size_t size = m_bank_sizes[n];
+    if (!m_compressed || size == BANK_SIZE)
+    {
+        // stored as it is, or the end of an uncompressed image
+        std::copy_n(m_banks[n], size, dst.begin());
+        std::fill(dst.begin() + size, dst.end(), 0xFF);
+        return;
+    }
+    if (!lz_decode(m_banks[n], size, dst.data(), dst.size()))
+        throw MachineException("Rom: Corrupt compressed bank");
+}
+
+std::shared_ptr<Rom> Rom::create(const uint8_t* data, size_t size, bool mapped)
+{
+    // owned right away, so that a bad image is unmapped again
+    std::shared_ptr<Rom> rom{new Rom(data, size, mapped)};
+    rom->index();
+    if (!valid_header(rom->m_header, rom->size()))
+        throw MachineException("Rom: Invalid cartridge header");
+    return rom;
+}
+
+std::shared_ptr<const Rom> Rom::open(const std::string& filename)
+{
+#ifdef __unix__
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) throw MachineException("Rom: Could not open file");
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size <= 0)
+    {
+        ::close(fd);
+        throw MachineException("Rom: Could not read file size");
+    }
+    const size_t size = st.st_size;
+    int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    // fault everything in now, instead of during emulation
+    flags |= MAP_POPULATE;
+#endif
+    void* data = mmap(nullptr, size, PROT_READ, flags, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) throw MachineException("Rom: Unable to map file");
+    return create((const uint8_t*) data, size, true);
+#else
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) throw MachineException("Rom: Could not open file");
+    const std::vector<uint8_t> image{std::istreambuf_iterator<char>(file), {}};
+    return copy({(const char*) image.data(), image.size()});
+#endif
+}
+
+std::shared_ptr<const Rom> Rom::copy(const std::string_view image)
+{
+    std::vector<uint8_t> data(image.begin(), image.end());
+    // the buffer stays where it is when moved into the Rom
+    const uint8_t* buffer = data.data();
+    auto rom = create(buffer, data.size(), false);
+    rom->m_copy = std::move(data);
+    return rom;
+}
+
+std::shared_ptr<const Rom> Rom::view(const std::string_view image)
+{
+    std::shared_ptr<Rom> rom{new Rom((const uint8_t*) image.data(), image.size(), false)};
+    rom->index();
+    return rom;
+}
+
+std::string Rom::title() const
+{
+    std::string result;
+    if (!this->has_header()) return result;
+    for (size_t i = 0x134; i < 0x144 && m_header[i] >= 0x20 && m_header[i] < 0x7F; i++)
+        result.append(1, (char) m_header[i]);
+    return result;
+}
+
+bool Rom::valid_header(const uint8_t* rom, const size_t size) noexcept
+{
+    // at least two banks, and only whole banks
+    if (size < 2 * BANK_SIZE || size % BANK_SIZE != 0) return false;
+    uint8_t checksum = 0;
+    for (size_t i = 0x134; i < 0x14D; i++) checksum = checksum - rom[i] - 1;
+    if (checksum != rom[0x14D]) return false;
+    // the ROM size field can't promise more banks than there are
+    return rom[0x148] <= 0x8 && (size_t(0x8000) << rom[0x148]) <= size;
+}
+bool Rom::header_valid(const std::string_view image) noexcept
+{
+    return valid_header((const uint8_t*) image.data(), image.size());
+}
+
+std::vector<uint8_t> Rom::compress(const std::string_view image)
+{
+    if (!header_valid(image)) throw MachineException("Rom: Invalid cartridge header");
+    const auto* data = (const uint8_t*) image.data();
+    const size_t banks = image.size() / BANK_SIZE;
+    std::vector<uint8_t> result(COMPRESSED_MAGIC, COMPRESSED_MAGIC + 4);
+    write32(result, banks);
+    std::vector<uint8_t> payload;
+    for (size_t n = 0; n < banks; n++)
+    {
+        const uint8_t* bank = data + n * BANK_SIZE;
+        auto block = lz_encode(bank, BANK_SIZE);
+        if (block.size() >= BANK_SIZE) block.assign(bank, bank + BANK_SIZE);
+        write32(result, block.size());
+        payload.insert(payload.end(), block.begin(), block.end());
+    }
+    result.insert(result.end(), payload.begin(), payload.end());
+    return result;
+}
+} // namespace gbc
@@ -0,0 +1,73 @@
+#pragma once
+#include "common.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace gbc
+{
+// A read-only cartridge image, mapped from a file or copied from memory.
+// Machines keep a reference to it, so one image can back any number of them.
+// The image can also be block-compressed (see compress()), in which case
+// machines decompress the banks they use into a small cache of their own.
+class Rom
+{
+public:
+    static constexpr size_t BANK_SIZE = 0x4000;
+    using bank_t = std::array<uint8_t, BANK_SIZE>;
+    // map @filename read-only, throwing MachineException on failure
+    static std::shared_ptr<const Rom> open(const std::string& filename);
+    // copy an image that is already in memory
+    static std::shared_ptr<const Rom> copy(std::string_view image);
+    // refer to an image that outlives the Rom, without copying or checking it
+    static std::shared_ptr<const Rom> view(std::string_view image);
+    ~Rom();
+
+    // the image as loaded, which is compressed for compressed images
+    std::string_view data() const noexcept { return {(const char*) m_data, m_size}; }
+    // the size of the cartridge ROM, after decompression
+    size_t size() const noexcept { return m_compressed ? m_banks.size() * BANK_SIZE : m_size; }
+    size_t banks() const noexcept { return m_banks.size(); }
+    // the start of 16kB bank @n, wrapped around the number of banks,
+    // or nullptr when the image is compressed
+    const uint8_t* bank(size_t n) const noexcept
+    {
+        return m_compressed ? nullptr : m_banks[n % m_banks.size()];
+    }
+    bool compressed() const noexcept { return m_compressed; }
+    // decompress bank @n, wrapped around the number of banks, into @dst
+    void decompress(size_t n, bank_t& dst) const;
+
+    // empty and 0 for images too short to have a header, which only view() accepts
+    std::string title() const;
+    uint8_t cartridge_type() const noexcept { return has_header() ? m_header[0x147] : 0; }
+    // header checksum and size checks, like the boot ROM (and a bit more)
+    static bool header_valid(std::string_view image) noexcept;
+    // a block-compressed image, where each bank can be decompressed alone
+    static std::vector<uint8_t> compress(std::string_view image);
+
+private:
+    Rom(const uint8_t* data, size_t size, bool mapped);
+    static std::shared_ptr<Rom> create(const uint8_t* data, size_t size, bool mapped);
+    static bool valid_header(const uint8_t* header, size_t size) noexcept;
+    bool has_header() const noexcept { return m_compressed || m_size >= m_header_copy.size(); }
+    void index();
+    void parse_compressed();
+
+    const uint8_t* m_data;
+    size_t m_size;
+    bool m_mapped;              // otherwise m_data points into m_copy, or elsewhere
+    bool m_compressed = false;
+    std::vector<uint8_t> m_copy;
+    // the start of each bank in the image, compressed or not
+    std::vector<const uint8_t*> m_banks;
+    std::vector<uint32_t> m_bank_sizes;
+    // the cartridge header, also when compressed
+    const uint8_t* m_header;
+    std::array<uint8_t, 0x150> m_header_copy;
+};
+} // namespace gbc
@@ -0,0 +1,52 @@
+#include "scheduler.hpp"
+#include "machine.hpp"
+
+namespace gbc
+{
+Scheduler::Scheduler(Machine& mach) noexcept : m_machine(mach) { this->reset(); }
+
+void Scheduler::reset() noexcept
+{
+    m_deadlines.fill(NEVER);
+    m_next_event = NEVER;
+}
+
+void Scheduler::run_events(const uint64_t now)
+{
+    this->m_dispatches++;
+    for (int ev = 0; ev < NUM_EVENTS; ev++)
+    {
+        if (m_deadlines[ev] <= now)
+        {
+            // the handler is responsible for scheduling its next event
+            this->cancel((event_t) ev);
+            this->dispatch((event_t) ev);
+        }
+    }
+}
+
+void Scheduler::dispatch(const event_t ev)
+{
+    switch (ev)
+    {
+    case GPU_EVENT:
+        machine().gpu.simulate();
+        return;
+    case TIMER_EVENT:
+        machine().io.timer_event();
+        return;
+    case DMA_EVENT:
+        machine().io.dma_event();
+        return;
+    case HDMA_EVENT:
+        machine().io.hdma_event();
+        return;
+    case APU_EVENT:
+        machine().apu.simulate();
+        return;
+    case NUM_EVENTS:
+        break;
+    }
+    GBC_ASSERT(0 && "Unknown scheduler event");
+}
+} // namespace gbc
@@ -0,0 +1,58 @@
+#pragma once
+#include "common.hpp"
+#include <array>
+#include <cstdint>
+
+namespace gbc
+{
+class Scheduler
+{
+public:
+    // when several events are due on the same cycle they are dispatched
+    // in this order, which is the order the devices used to be ticked in
+    enum event_t
+    {
+        GPU_EVENT = 0,
+        TIMER_EVENT,
+        DMA_EVENT,
+        HDMA_EVENT,
+        APU_EVENT,
+        NUM_EVENTS
+    };
+    static constexpr uint64_t NEVER = UINT64_MAX;
+
+    Scheduler(Machine&) noexcept;
+    void reset() noexcept;
+
+    void schedule(event_t, uint64_t when) noexcept;
+    void cancel(event_t ev) noexcept { this->schedule(ev, NEVER); }
+    uint64_t deadline(event_t ev) const noexcept { return m_deadlines[ev]; }
+    // cycle of the earliest pending event
+    const uint64_t& next_event() const noexcept { return m_next_event; }
+    // number of times events have been dispatched
+    uint64_t dispatches() const noexcept { return m_dispatches; }
+    bool is_due(uint64_t now) const noexcept { return now >= m_next_event; }
+    // dispatch every event that is due at cycle @now
+    void run_events(uint64_t now);
+
+    Machine& machine() noexcept { return m_machine; }
+
+private:
+    void dispatch(event_t);
+
+    Machine& m_machine;
+    std::array<uint64_t, NUM_EVENTS> m_deadlines;
+    uint64_t m_next_event = NEVER;
+    uint64_t m_dispatches = 0;
+};
+
+inline void Scheduler::schedule(event_t ev, uint64_t when) noexcept
+{
+    m_deadlines[ev] = when;
+    m_next_event = NEVER;
+    for (const uint64_t deadline : m_deadlines)
+    {
+        if (deadline < m_next_event) m_next_event = deadline;
+    }
+}
+} // namespace gbc
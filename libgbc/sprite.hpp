@@ -1,11 +1,12 @@
 #pragma once
 #include "memory.hpp"
+#include "tiledata.hpp"
 
 namespace gbc
 {
 struct sprite_config_t
 {
-    const uint8_t* patterns;
+    const uint8_t* patterns[2]; // one per VRAM bank
     uint8_t palette[2];
     int scan_x;
     int scan_y;
@@ -30,8 +31,11 @@ public:
     int pal() const noexcept { return (attr & 0x10) >> 4; }
     int cgb_bank() const noexcept { return (attr & 0x8) >> 3; }
     int cgb_pal() const noexcept { return attr & 0x7; }
+    uint8_t attributes() const noexcept { return attr; }
 
-    uint8_t pixel(const sprite_config_t&) const;
+    // the 8 pixels on the current scanline, left to right, as one color
+    // index per byte (see BITPLANE_TABLE)
+    uint64_t pattern_row(const sprite_config_t&) const;
 
     int start_x() const noexcept { return xpos - 8; }
     int start_y() const noexcept { return ypos - 16; }
@@ -48,22 +52,15 @@ private:
     uint8_t attr;
 };
 
-inline uint8_t Sprite::pixel(const sprite_config_t& config) const
+inline uint64_t Sprite::pattern_row(const sprite_config_t& config) const
 {
-    int tx = config.scan_x - start_x();
     int ty = config.scan_y - start_y();
-    if (tx < 0 || tx >= SPRITE_W) return 0;
-    if (this->flipx()) tx = SPRITE_W - 1 - tx;
     if (this->flipy()) ty = config.height - 1 - ty;
 
-    int offset = this->pattern * 16 + ty * 2;
-    if (config.is_cgb) offset += cgb_bank() * 0x2000;
-    uint8_t c0 = config.patterns[offset];
-    uint8_t c1 = config.patterns[offset + 1];
-    // return combined 4-bits, right to left
-    const int bit = 7 - tx;
-    const int v0 = (c0 >> bit) & 0x1;
-    const int v1 = (c1 >> bit) & 0x1;
-    return v0 | (v1 << 1);
+    const int offset = this->pattern * 16 + ty * 2;
+    const uint8_t* patterns = config.patterns[config.is_cgb ? cgb_bank() : 0];
+    // the flipped table reverses the bits as it expands them
+    const auto& table = this->flipx() ? BITPLANE_TABLE_FLIPPED : BITPLANE_TABLE;
+    return table[patterns[offset]] | (table[patterns[offset + 1]] << 1);
 }
 } // namespace gbc
@@ -0,0 +1,84 @@
+#pragma once
+#include "memory.hpp"
+#include <array>
+#include <bitset>
+#include <memory>
+
+namespace gbc
+{
+// each bit of a bitplane byte spread out into a byte of its own, with the
+// leftmost pixel in the lowest byte (or the rightmost, when flipped)
+constexpr std::array<uint64_t, 256> make_bitplane_table(const bool flip)
+{
+    std::array<uint64_t, 256> table{};
+    for (size_t b = 0; b < table.size(); b++)
+        for (int px = 0; px < 8; px++)
+        {
+            const int bit = flip ? px : 7 - px;
+            table[b] |= uint64_t((b >> bit) & 1) << (px * 8);
+        }
+    return table;
+}
+inline constexpr auto BITPLANE_TABLE = make_bitplane_table(false);
+inline constexpr auto BITPLANE_TABLE_FLIPPED = make_bitplane_table(true);
+
+// Tile patterns from both VRAM banks, decoded into rows of one color index
+// per byte (see BITPLANE_TABLE) the first time they are used after a write.
+// The rows of each bank are allocated on first use, so machines that never
+// render don't pay for them, and DMG machines only pay for bank 0.
+class TileCache
+{
+public:
+    static constexpr int TILES = 384; // in each VRAM bank
+    static constexpr int PATTERN_SIZE = 16;
+
+    TileCache(const Memory& memory) : m_memory(memory) {}
+
+    // row @y of tile @tile in VRAM @bank, which must be from 0 to 383
+    uint64_t row(int bank, int tile, int y);
+    // @offset is into both VRAM banks, where bank 1 starts at 0x2000
+    void written(uint16_t offset) noexcept;
+    void invalidate() noexcept { this->m_valid.reset(); }
+    size_t footprint() const noexcept;
+
+private:
+    void decode(int bank, int tile);
+
+    const Memory& m_memory;
+    using tile_t = std::array<uint64_t, 8>;
+    using bank_t = std::array<tile_t, TILES>;
+    std::array<std::unique_ptr<bank_t>, 2> m_rows;
+    std::bitset<2 * TILES> m_valid;
+};
+
+inline uint64_t TileCache::row(int bank, int tile, int y)
+{
+    const int index = bank * TILES + tile;
+    if (UNLIKELY(!m_valid[index])) this->decode(bank, tile);
+    return (*m_rows[bank])[tile][y];
+}
+inline void TileCache::decode(int bank, int tile)
+{
+    if (m_rows[bank] == nullptr) this->m_rows[bank] = std::make_unique<bank_t>();
+    const uint8_t* pattern = m_memory.video_bank_ptr(bank) + tile * PATTERN_SIZE;
+    auto& rows = (*m_rows[bank])[tile];
+    for (size_t y = 0; y < rows.size(); y++)
+    {
+        rows[y] = BITPLANE_TABLE[pattern[y * 2]] | (BITPLANE_TABLE[pattern[y * 2 + 1]] << 1);
+    }
+    this->m_valid.set(bank * TILES + tile);
+}
+inline size_t TileCache::footprint() const noexcept
+{
+    size_t size = 0;
+    for (const auto& rows : m_rows)
+        if (rows != nullptr) size += sizeof(*rows);
+    return size;
+}
+inline void TileCache::written(uint16_t offset) noexcept
+{
+    const int bank = offset / 0x2000;
+    const int tile = (offset % 0x2000) / PATTERN_SIZE;
+    if (tile < TILES) this->m_valid.reset(bank * TILES + tile);
+}
+} // namespace gbc
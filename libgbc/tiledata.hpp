@@ -1,5 +1,6 @@
 #pragma once
 #include "memory.hpp"
+#include "tile_cache.hpp"
 
 namespace gbc
 {
@@ -15,29 +16,38 @@ public:
     static const int TILE_W = 8;
     static const int TILE_H = 8;
 
-    TileData(const uint8_t* tile, const uint8_t* pattern, const uint8_t* attr, bool sign)
-        : m_tile_base(tile), m_patt_base(pattern), m_attr_base(attr), m_signed(sign)
+    // @first_tile is the number of the tile at @pattern in the tile cache
+    TileData(TileCache& cache, const uint8_t* tile, const uint8_t* pattern,
+             const uint8_t* pattern1, int first_tile, const uint8_t* attr, bool sign)
+        : m_cache(cache), m_tile_base(tile), m_patt_base(pattern), m_patt_bank1(pattern1),
+          m_first_tile(first_tile), m_attr_base(attr), m_signed(sign)
     {}
 
-    int tile_attr(int tx, int ty);
-    int tile_id(int tx, int ty);
+    int tile_attr(int tx, int ty) const;
+    int tile_id(int tx, int ty) const;
     int pattern(int t, int tattr, int dx, int dy) const;
+    // all 8 pixels of row @dy, as one color index per byte (see BITPLANE_TABLE),
+    // from the tile cache
+    uint64_t pattern_row(int t, int tattr, int dy) const;
     int pattern(const uint8_t* base, int tattr, int t, int dx, int dy) const;
     void set_tilebase(const uint8_t* new_base) { m_tile_base = new_base; }
 
 private:
+    TileCache& m_cache;
     const uint8_t* m_tile_base;
     const uint8_t* m_patt_base;
+    const uint8_t* m_patt_bank1; // the same patterns in VRAM bank 1
+    const int m_first_tile;
     const uint8_t* m_attr_base;
     const bool m_signed;
 };
 
-inline int TileData::tile_id(int x, int y)
+inline int TileData::tile_id(int x, int y) const
 {
     if (this->m_signed) return 128 + (int8_t) m_tile_base[y * 32 + x];
     return m_tile_base[y * 32 + x];
 }
-inline int TileData::tile_attr(int x, int y)
+inline int TileData::tile_attr(int x, int y) const
 {
     if (m_attr_base == nullptr) return 0;
     return m_attr_base[y * 32 + x];
@@ -47,7 +57,6 @@ inline int TileData::pattern(const uint8_t* base, int tid, int tattr, int tx, in
 {
     if (tattr & 0x20) tx = 7 - tx;
     if (tattr & 0x40) ty = 7 - ty;
-    if (tattr & 0x08) base += 0x2000;
     const int offset = 16 * tid + ty * 2;
     // get 16-bit c0, c1
     uint8_t c0 = base[offset];
@@ -60,6 +69,13 @@ inline int TileData::pattern(const uint8_t* base, int tid, int tattr, int tx, in
 } // pattern(...)
 inline int TileData::pattern(int tid, int tattr, int tx, int ty) const
 {
-    return pattern(m_patt_base, tid, tattr, tx, ty);
+    return pattern((tattr & 0x08) ? m_patt_bank1 : m_patt_base, tid, tattr, tx, ty);
+}
+inline uint64_t TileData::pattern_row(int tid, int tattr, int ty) const
+{
+    if (tattr & 0x40) ty = 7 - ty;
+    const uint64_t row = m_cache.row((tattr & 0x08) ? 1 : 0, m_first_tile + tid, ty);
+    // one pixel per byte, so flipping is reversing the bytes
+    return (tattr & 0x20) ? __builtin_bswap64(row) : row;
 }
 } // namespace gbc
@@ -208,10 +208,10 @@ static void write_recorded_state(const buffer_t& inputs)
 
 #include <future>
 #include <thread>
-static training_results_t training_session(const int tidx, const buffer_t& romdata,
+static training_results_t training_session(const int tidx, std::shared_ptr<const gbc::Rom> rom,
                                            const buffer_t machine_state)
 {
-    gbc::Machine machine{romdata};
+    gbc::Machine machine{std::move(rom)};
     machine.gpu.scanline_rendering(false);
     if (!machine_state.empty()) { machine.restore_state(machine_state); }
 
@@ -228,8 +228,9 @@ int main(int argc, char** args)
     const char* romfile = "../smbland2_dx.gbc";
     if (argc >= 2) romfile = args[1];
 
-    const auto romdata = load_file(romfile);
-    printf("Loaded %zu bytes ROM\n", romdata.size());
+    // every session shares the same mapped ROM image
+    const auto rom = gbc::Rom::open(romfile);
+    printf("Loaded %zu bytes ROM\n", rom->size());
 
     srand(time(0));
 
@@ -242,7 +243,7 @@ int main(int argc, char** args)
     {
         for (size_t i = 0; i < NUM_THREADS; i++)
         {
-            futures.at(i) = std::async(std::launch::async, training_session, i + 1, romdata,
+            futures.at(i) = std::async(std::launch::async, training_session, i + 1, rom,
                                        best_snapshot.state);
         }
         for (size_t i = 0; i < NUM_THREADS; i++)